@@ -0,0 +1,84 @@
+#pragma once
+
+// Sampling from a discrete distribution in O(1) by Walker's alias method,
+// built in O(n) by Vose's algorithm ("A Linear Algorithm for Generating
+// Random Numbers with a Given Distribution", 1991). Each of the n columns
+// holds its own outcome with probability prob_[i] and another outcome,
+// alias_[i], otherwise, so a draw needs one uniform, a multiply, and one
+// comparison however many outcomes there are.
+
+#include <algorithm>
+#include <vector>
+
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    // Build the table for outcomes 0..n-1 with the given relative weights.
+    // Returns false if some weight is negative or none is positive; the
+    // table then picks uniformly.
+    bool build(const std::vector<double>& weights) {
+        int n = int(weights.size());
+        prob_.assign(n, 1.0);
+        alias_.resize(n);
+        for (int i = 0; i < n; ++i) {
+            alias_[i] = i;
+        }
+        double total = 0;
+        for (double w : weights) {
+            if (w < 0) {
+                return false;
+            }
+            total += w;
+        }
+        if (!(total > 0)) {
+            return false;
+        }
+        std::vector<double> scaled(n);
+        std::vector<int> small, large;
+        for (int i = 0; i < n; ++i) {
+            scaled[i] = weights[i] * n / total;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back();
+            int l = large.back();
+            small.pop_back();
+            prob_[s] = scaled[s];
+            alias_[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // Whatever is left is 1 up to rounding error; but never let rounding
+        // make an outcome of zero weight possible.
+        int heaviest = int(std::max_element(weights.begin(), weights.end()) - weights.begin());
+        for (int i : small) {
+            prob_[i] = (weights[i] > 0) ? 1 : 0;
+            alias_[i] = heaviest;
+        }
+        for (int i : large) {
+            prob_[i] = 1;
+        }
+        return true;
+    }
+
+    int size() const { return int(prob_.size()); }
+
+    // An outcome, given u uniform in [0, 1). The integer part of u * n picks
+    // the column, and the fractional part decides between its two outcomes.
+    int sample(double u) const {
+        double x = u * int(prob_.size());
+        int i = int(x);
+        if (i >= int(prob_.size())) {
+            i = int(prob_.size()) - 1;  // only by rounding
+        }
+        return (x - i < prob_[i]) ? i : alias_[i];
+    }
+
+private:
+    std::vector<double> prob_;
+    std::vector<int> alias_;
+};
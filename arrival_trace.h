@@ -0,0 +1,228 @@
+#pragma once
+
+// Recorded arrivals (from badge readers, call logs, and so on) to replay
+// in place of random users. Each record gives a user's arrival time, floors,
+// and patience, in ticks, in order of arrival time.
+//
+// The binary format is a 16-byte header ("KEARRIV1" and a little-endian
+// 64-bit record count) followed by 16-byte records. MappedArrivalFile maps
+// such a file into memory and reads it in place, so a month-long log is
+// never copied onto the heap. CsvArrivalStream reads "time,in,out,giveup"
+// lines one at a time from any FILE (such as a pipe), holding only one
+// record of lookahead; writeBinaryArrivals converts CSV to binary once.
+// A CSV line that can't be read, or names a floor that doesn't exist, is
+// an error: replaying a log with arrivals silently missing would be worse.
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct ArrivalRecord {
+    int64_t time_;    // when the user arrives
+    int32_t giveup_;  // how long the user will wait before walking away
+    int16_t in_;      // floor on which the user arrives
+    int16_t out_;     // floor the user wants to go to
+};
+static_assert(sizeof(ArrivalRecord) == 16, "ArrivalRecord is a file format");
+
+static const char arrivalFileMagic[8] = { 'K', 'E', 'A', 'R', 'R', 'I', 'V', '1' };
+
+class ArrivalSource {
+public:
+    virtual ~ArrivalSource() = default;
+
+    // The next record, or nullptr when there are no more (or after an error).
+    virtual const ArrivalRecord *peek() = 0;
+    virtual void pop() = 0;
+
+    // Did reading stop at a bad record (having printed why)?
+    virtual bool failed() const { return false; }
+};
+
+class MappedArrivalFile : public ArrivalSource {
+public:
+    // Returns false, having printed why, if the file isn't a valid arrival file.
+    bool open(const char *path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            perror(path);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            perror(path);
+            close(fd);
+            return false;
+        }
+        bytes_ = size_t(st.st_size);
+        if (bytes_ < 16) {
+            fprintf(stderr, "%s: not an arrival file\n", path);
+            close(fd);
+            return false;
+        }
+        void *p = mmap(nullptr, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            perror(path);
+            return false;
+        }
+        base_ = static_cast<const char*>(p);
+        madvise(p, bytes_, MADV_SEQUENTIAL);
+        uint64_t count;
+        memcpy(&count, base_ + 8, sizeof count);
+        if (memcmp(base_, arrivalFileMagic, 8) != 0 || count != (bytes_ - 16) / sizeof(ArrivalRecord)) {
+            fprintf(stderr, "%s: not an arrival file, or truncated\n", path);
+            return false;
+        }
+        records_ = reinterpret_cast<const ArrivalRecord*>(base_ + 16);
+        count_ = count;
+        return true;
+    }
+
+    ~MappedArrivalFile() {
+        if (base_ != nullptr) {
+            munmap(const_cast<char*>(base_), bytes_);
+        }
+    }
+
+    const ArrivalRecord *peek() override { return (next_ < count_) ? &records_[next_] : nullptr; }
+    void pop() override { next_ += 1; }
+
+    // Does this file start with the binary format's magic number?
+    static bool isBinary(const char *path) {
+        char magic[8] = {};
+        FILE *fp = fopen(path, "rb");
+        if (fp == nullptr) {
+            return false;
+        }
+        bool binary = (fread(magic, 1, 8, fp) == 8 && memcmp(magic, arrivalFileMagic, 8) == 0);
+        fclose(fp);
+        return binary;
+    }
+
+private:
+    const char *base_ = nullptr;
+    size_t bytes_ = 0;
+    const ArrivalRecord *records_ = nullptr;
+    uint64_t count_ = 0;
+    uint64_t next_ = 0;
+};
+
+class CsvArrivalStream : public ArrivalSource {
+public:
+    // Floors must be in [0, floors).
+    explicit CsvArrivalStream(FILE *fp, const char *name, int floors) : fp_(fp), name_(name), floors_(floors) {}
+
+    const ArrivalRecord *peek() override {
+        if (!hasNext_ && !eof_) {
+            hasNext_ = readRecord(next_);
+            eof_ = !hasNext_;
+        }
+        return hasNext_ ? &next_ : nullptr;
+    }
+
+    void pop() override { hasNext_ = false; }
+
+    bool failed() const override { return failed_; }
+
+    // Read the next "time,in,out,giveup" line, skipping blank lines,
+    // comments starting with '#', and a header line. Returns false at the
+    // end of the file, or (having printed why, and set failed()) at a
+    // line that isn't a valid record.
+    bool readRecord(ArrivalRecord& r) {
+        char line[256];
+        while (fgets(line, sizeof line, fp_) != nullptr) {
+            lineNumber_ += 1;
+            const char *p = line;
+            while (isspace((unsigned char)*p)) {
+                ++p;
+            }
+            if (*p == '\0' || *p == '#' || (lineNumber_ == 1 && !isdigit((unsigned char)*p))) {
+                continue;
+            }
+            long long time, in, out, giveup;
+            int n = 0;
+            if (sscanf(p, "%lld ,%lld ,%lld ,%lld %n", &time, &in, &out, &giveup, &n) != 4 || p[n] != '\0') {
+                return this->fail("expected time,in,out,giveup");
+            }
+            if (in < 0 || in >= floors_ || out < 0 || out >= floors_) {
+                return this->fail("no such floor");
+            }
+            if (giveup < 0 || giveup > INT32_MAX) {
+                return this->fail("give-up time out of range");
+            }
+            r.time_ = time;
+            r.in_ = int16_t(in);
+            r.out_ = int16_t(out);
+            r.giveup_ = int32_t(giveup);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    bool fail(const char *problem) {
+        fprintf(stderr, "%s:%lld: %s\n", name_, lineNumber_, problem);
+        failed_ = true;
+        return false;
+    }
+
+    FILE *fp_;
+    const char *name_;
+    int floors_;
+    long long lineNumber_ = 0;
+    bool failed_ = false;
+    ArrivalRecord next_;
+    bool hasNext_ = false;
+    bool eof_ = false;
+};
+
+// Convert a CSV arrival log, for a building with the given number of
+// floors, into the binary format; returns the number of records written,
+// or -1 (having printed why) on failure.
+inline long long writeBinaryArrivals(const char *csvPath, const char *binaryPath, int floors)
+{
+    FILE *in = (strcmp(csvPath, "-") == 0) ? stdin : fopen(csvPath, "r");
+    if (in == nullptr) {
+        perror(csvPath);
+        return -1;
+    }
+    FILE *out = fopen(binaryPath, "wb");
+    if (out == nullptr) {
+        perror(binaryPath);
+        if (in != stdin) {
+            fclose(in);
+        }
+        return -1;
+    }
+    uint64_t count = 0;
+    fwrite(arrivalFileMagic, 1, 8, out);
+    fwrite(&count, sizeof count, 1, out);
+    CsvArrivalStream csv(in, csvPath, floors);
+    ArrivalRecord r;
+    while (csv.readRecord(r)) {
+        fwrite(&r, sizeof r, 1, out);
+        count += 1;
+    }
+    fseek(out, 8, SEEK_SET);
+    fwrite(&count, sizeof count, 1, out);
+    bool ok = !ferror(out);
+    ok = (fclose(out) == 0) && ok;
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (!ok) {
+        perror(binaryPath);
+    }
+    if (!ok || csv.failed()) {
+        remove(binaryPath);
+        return -1;
+    }
+    return (long long)count;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// An allocator that keeps count, in a MemoryAccount, of the bytes and
+// blocks it currently holds and the most it has ever held at once.
+// Containers (or allocate_shared) given allocators that point to the same
+// account are counted together. A default-constructed allocator points to
+// no account and counts nothing; it is only there so that containers can be
+// default-constructed and then assigned a counted container.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <new>
+#include <type_traits>
+
+// Every allocation made by each thread, of any kind, when the program is
+// built with -DCOUNT_ALLOCATIONS and replaces the global operator new to
+// count them (as cxx14.cpp does); otherwise always zero. The counts are
+// thread-local, so counting costs no synchronization.
+#ifndef COUNT_ALLOCATIONS
+#define COUNT_ALLOCATIONS 0
+#endif
+
+struct AllocationCounts {
+    long long allocations_ = 0;
+    long long bytes_ = 0;
+};
+
+inline AllocationCounts& allocationCounts()
+{
+    static thread_local AllocationCounts counts;
+    return counts;
+}
+
+struct MemoryAccount {
+    long long bytes_ = 0;
+    long long blocks_ = 0;
+    long long peakBytes_ = 0;
+    long long peakBlocks_ = 0;
+    long long allocations_ = 0;  // ever made
+
+    void allocated(size_t n) {
+        bytes_ += n;
+        blocks_ += 1;
+        allocations_ += 1;
+        peakBytes_ = std::max(peakBytes_, bytes_);
+        peakBlocks_ = std::max(peakBlocks_, blocks_);
+    }
+
+    void deallocated(size_t n) {
+        bytes_ -= n;
+        blocks_ -= 1;
+    }
+
+    void print(FILE *fp, const char *label) const {
+        fprintf(fp, "#   %-12s %10lld bytes in %7lld blocks now, peak %10lld bytes in %7lld blocks, %lld allocations\n",
+            label, bytes_, blocks_, peakBytes_, peakBlocks_, allocations_);
+    }
+};
+
+template<class T>
+struct CountingAllocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    MemoryAccount *account_ = nullptr;
+
+    CountingAllocator() = default;
+    explicit CountingAllocator(MemoryAccount *account) : account_(account) {}
+
+    template<class U>
+    CountingAllocator(const CountingAllocator<U>& rhs) : account_(rhs.account_) {}
+
+    T *allocate(size_t n) {
+        if (account_ != nullptr) {
+            account_->allocated(n * sizeof(T));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (account_ != nullptr) {
+            account_->deallocated(n * sizeof(T));
+        }
+        ::operator delete(p);
+    }
+
+    template<class U>
+    friend bool operator==(const CountingAllocator& a, const CountingAllocator<U>& b) { return a.account_ == b.account_; }
+    template<class U>
+    friend bool operator!=(const CountingAllocator& a, const CountingAllocator<U>& b) { return a.account_ != b.account_; }
+};
@@ -1,542 +1,934 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
-#include <deque>
+#include <cstring>
 #include <memory>
-#include <string>
+#include <mutex>
+#include <new>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "elevator_simulation.h"
+#include "ensemble.h"
+
+// Built with -DCOUNT_ALLOCATIONS (as go-bench is), every allocation is
+// counted in allocationCounts(), for --bench and --memory; otherwise
+// operator new is left alone.
+#if COUNT_ALLOCATIONS
+// Every form of operator new and operator delete is replaced, so that
+// memory from any of them (such as the nothrow new behind stable_sort's
+// buffer) is allocated and freed consistently, with malloc and free.
+static void *countedAllocation(size_t n) noexcept
+{
+    allocationCounts().allocations_ += 1;
+    allocationCounts().bytes_ += n;
+    return malloc(n ? n : 1);
+}
 
-#include "xoshiro256ss.h"
+// Out of line, so that GCC, having inlined an operator delete, doesn't
+// see free() called on what operator new returned and warn about it.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void release(void *p) noexcept
+{
+    free(p);
+}
 
-template<class T>
-void std_erase(std::deque<T>& ctr, const T& value)
+void *operator new(size_t n)
 {
-    assert(std::count(ctr.begin(), ctr.end(), value) <= 1);
-    auto it = std::find(ctr.begin(), ctr.end(), value);
-    if (it != ctr.end()) {
-        ctr.erase(it);
+    if (void *p = countedAllocation(n)) {
+        return p;
     }
+    throw std::bad_alloc();
 }
 
-struct ElevatorSimulation;
+void *operator new[](size_t n) { return operator new(n); }
+void *operator new(size_t n, const std::nothrow_t&) noexcept { return countedAllocation(n); }
+void *operator new[](size_t n, const std::nothrow_t&) noexcept { return countedAllocation(n); }
 
-using Floor = int;     // 0 through 4
-using Time = int;      // timestamp, in tenths of seconds
-using Duration = int;  // duration, in tenths of seconds
+void operator delete(void *p) noexcept { release(p); }
+void operator delete[](void *p) noexcept { release(p); }
+void operator delete(void *p, size_t) noexcept { release(p); }
+void operator delete[](void *p, size_t) noexcept { release(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { release(p); }
 
-enum Direction { GoingUp, GoingDown, Neutral };
+#if __cpp_aligned_new
+// Over-aligned types, from C++17 on.
+static void *countedAllocation(size_t n, std::align_val_t alignment) noexcept
+{
+    size_t a = std::max(size_t(alignment), sizeof(void*));
+    allocationCounts().allocations_ += 1;
+    allocationCounts().bytes_ += n;
+    return aligned_alloc(a, (n + a - 1) / a * a);
+}
 
-struct Task : public std::enable_shared_from_this<Task> {
-    int nextinst_ = 1;
-    int nexttime_ = -1;
+void *operator new(size_t n, std::align_val_t a)
+{
+    if (void *p = countedAllocation(n, a)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
 
-    struct ByNextTime {
-        template<class T>
-        bool operator()(const std::shared_ptr<T>& p, const std::shared_ptr<T>& q) const {
-            return p->nexttime_ < q->nexttime_;
-        }
-    };
+void *operator new[](size_t n, std::align_val_t a) { return operator new(n, a); }
+void *operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return countedAllocation(n, a); }
+void *operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return countedAllocation(n, a); }
 
-    virtual std::string stateStr() const = 0;
-    virtual void resume(ElevatorSimulation& sim) = 0;
-    virtual ~Task() = default;
+void operator delete(void *p, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { release(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept { release(p); }
+#endif
+#endif  // COUNT_ALLOCATIONS
+
+// Parameter sweeps.
+//
+//     ./go --sweep durationOfDoorOpen=10,20,30 --sweep maxInterarrivalTime=300:900:200 --reps 8
+//
+// runs every combination of the listed values, each for `--reps` independent
+// replications, spread over `--threads` worker threads. One CSV row is written
+// per combination as soon as all of its replications have finished.
+// Replication r always uses seed `--seed` plus r; with `--crn`, every
+// combination then sees exactly the same arrivals in its r'th replication.
+// With `--warmup` or `--restore`, every run is instead a fork of one warm
+// simulation, reseeded, which runs for the deadline beyond the fork.
+
+struct SweepParameter {
+    const char *name;
+    Duration ElevatorSimulation::*field;
 };
 
-struct ElevatorTask : public Task {
-    std::string stateStr() const override { return "E" + std::to_string(nextinst_); }
-    void resume(ElevatorSimulation& sim) override;
+static const SweepParameter sweepParameters[] = {
+#define X(name) { #name, &ElevatorSimulation::name }
+    X(durationBeforeRapidDoorClose),
+    X(durationBeforeInactivity),
+    X(durationBeforeDoorClose),
+    X(durationOfDoorOpen),
+    X(durationOfLeaving),
+    X(durationOfEntering),
+    X(delayAfterDoorFlutter),
+    X(durationOfDoorClose),
+    X(durationOfUpwardAcceleration),
+    X(durationOfDownwardAcceleration),
+    X(durationOfDoorOpenFromDecisionSubroutine),
+    X(delayBeforeHoming),
+    X(durationOfUpwardTravel),
+    X(durationOfUpwardDeceleration),
+    X(durationOfDownwardTravel),
+    X(durationOfDownwardDeceleration),
+    X(minGiveupTime),
+    X(maxGiveupTime),
+    X(minInterarrivalTime),
+    X(maxInterarrivalTime),
+#undef X
 };
 
-struct E5Task : public Task {
-    std::string stateStr() const override { return "E5"; }
-    void resume(ElevatorSimulation& sim) override;
+struct SweepAxis {
+    const SweepParameter *param = nullptr;
+    std::vector<Duration> values;
 };
 
-struct E9Task : public Task {
-    std::string stateStr() const override { return "E9"; }
-    void resume(ElevatorSimulation& sim) override;
-};
+// Parse "name=v1,v2,v3" or "name=lo:hi:step". Durations can't be negative.
+bool parseSweepAxis(const char *spec, SweepAxis& axis)
+{
+    const char *eq = strchr(spec, '=');
+    if (eq == nullptr) {
+        return false;
+    }
+    axis.param = nullptr;
+    for (const auto& p : sweepParameters) {
+        if (strlen(p.name) == size_t(eq - spec) && strncmp(p.name, spec, eq - spec) == 0) {
+            axis.param = &p;
+        }
+    }
+    if (axis.param == nullptr) {
+        return false;
+    }
+    axis.values.clear();
+    long long lo, hi, step;
+    char trailing;
+    if (sscanf(eq + 1, "%lld:%lld:%lld%c", &lo, &hi, &step, &trailing) == 3) {
+        if (step <= 0 || hi < lo || lo < 0) {
+            return false;
+        }
+        for (Duration v = lo; v <= hi; v += step) {
+            axis.values.push_back(v);
+        }
+        return true;
+    }
+    for (const char *p = eq + 1; true; ++p) {
+        char *end;
+        long long v = strtoll(p, &end, 10);
+        if (end == p || v < 0) {
+            return false;
+        }
+        axis.values.push_back(Duration(v));
+        p = end;
+        if (*p == '\0') {
+            return true;
+        } else if (*p != ',') {
+            return false;
+        }
+    }
+}
 
-struct UserTask : public Task {
-    Floor in_;
-    Floor out_;
-
-#if PRINT_STATISTICS
-    static int nextCounter() { static int c = 0; return ++c; }
-    int userNumber_ = nextCounter();
-    Time enteredQueueAt_;
-    Time enteredCarAt_;
-    int maxOccupancy_ = 0;
-    std::deque<Floor> stoppedAt_;
-#endif
+struct SweepOptions {
+    std::vector<SweepAxis> axes;
+    int replications = 10;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    Time deadline = 3600'0;
+    xoshiro256ss::u64 seed = 0;
+    bool commonRandomNumbers = false;
+    bool antithetic = false;
+    bool moduloBounded = false;
+    int processes = 0;  // if nonzero, run in this many worker processes instead of threads
+    int progressInterval = 0;  // seconds between snapshots on stderr; 0 means none
+    FILE *out = stdout;
+    FILE *histograms = nullptr;  // where to dump the pooled per-floor histograms, if anywhere
+    const TrafficProfile *traffic = nullptr;  // time-of-day traffic, if any
+    const ElevatorSimulation *warmStart = nullptr;  // if non-null, every run is a fork of it
+
+    int numberOfPoints() const {
+        int n = 1;
+        for (const auto& axis : axes) {
+            n *= int(axis.values.size());
+        }
+        return n;
+    }
 
-    std::shared_ptr<UserTask> shared_user_from_this() {
-        return std::static_pointer_cast<UserTask>(this->shared_from_this());
+    // Point i is the i'th element of the Cartesian product of all axes,
+    // with the last axis varying fastest.
+    Duration valueAt(int point, int axis) const {
+        for (int a = int(axes.size()) - 1; a > axis; --a) {
+            point /= int(axes[a].values.size());
+        }
+        return axes[axis].values[point % axes[axis].values.size()];
     }
+};
 
-    std::string stateStr() const override { return "U" + std::to_string(nextinst_); }
-    void resume(ElevatorSimulation& sim) override;
+struct RunResult {
+    long long queued = 0;
+    long long walked = 0;
+    long long arrived = 0;
+    double walkawayRate = 0;   // fraction of queued users who walked away
+    double meanQueueTime = 0;  // among users who arrived
+    double meanRideTime = 0;   // among users who arrived
+    double meanCarLoad = 0;    // time-weighted
+    double idleFraction = 0;   // fraction of the time spent dormant in E1
+    bool failed = false;       // did the run crash (in a worker process)?
 };
 
-struct ElevatorSimulation {
-public:
-    Duration durationBeforeRapidDoorClose = 25;
-    Duration durationBeforeInactivity = 300;
-    Duration durationBeforeDoorClose = 76;
-    Duration durationOfDoorOpen = 20;
-    Duration durationOfLeaving = 25;
-    Duration durationOfEntering = 25;
-    Duration delayAfterDoorFlutter = 40;
-    Duration durationOfDoorClose = 20;
-    Duration durationOfUpwardAcceleration = 15;
-    Duration durationOfDownwardAcceleration = 15;
-    Duration durationOfDoorOpenFromDecisionSubroutine = 20;
-    Duration delayBeforeHoming = 20;
-    Duration durationOfUpwardTravel = 51;
-    Duration durationOfUpwardDeceleration = 14;
-    Duration durationOfDownwardTravel = 61;
-    Duration durationOfDownwardDeceleration = 23;
-
-public:
-    xoshiro256ss rand_;
-
-    Floor floor_ = 2;
-    bool d1_ = false;  // Are the doors open AND people are getting in or out?
-    bool d2_ = false;  // Has the elevator been active within the last 30 seconds?
-    bool d3_ = false;  // Are the doors open BUT nobody is getting in or out?
-    Direction state_ = Neutral;
-
-    bool callup_[5] = {};
-    bool calldown_[5] = {};
-    bool callcar_[5] = {};
-
-    std::deque<std::shared_ptr<Task>> wait_;
-    std::deque<std::shared_ptr<UserTask>> queue_[5];
-    std::deque<std::shared_ptr<UserTask>> elevator_;
-
-    std::shared_ptr<ElevatorTask> elevatortask_ = std::make_shared<ElevatorTask>();
-    std::shared_ptr<E5Task> e5task_ = std::make_shared<E5Task>();
-    std::shared_ptr<E9Task> e9task_ = std::make_shared<E9Task>();
-
-public:
-    ElevatorSimulation() {
-        auto t = std::make_shared<UserTask>();
-        Time time_zero = 0;
-        this->schedule(t, 1, time_zero);  // The first user enters at time zero.
-    }
-
-    void runUntil(Time deadline) {
-        while (true) {
-            assert(!wait_.empty());
-            std::shared_ptr<Task> t = wait_.front();
-            if (t->nexttime_ >= deadline) {
-                return;
-            }
-            wait_.pop_front();
-            printf("%04d %c %d %c %c %c %s\n",
-                t->nexttime_, (state_ == Neutral ? 'N' : state_ == GoingUp ? 'U' : 'D'),
-                floor_, "0X"[int(d1_)], "0X"[int(d2_)], "0X"[int(d3_)], t->stateStr().c_str());
-#if 0
-            for (int i=0; i < 5; ++i) {
-                if (!queue_[i].empty()) printf("Queued on floor %d: %zu users\n", i, queue_[i].size());
-            }
-            if (!elevator_.empty()) printf("In the elevator: %zu users\n", elevator_.size());
-            printf("Tasks in the wait queue: ");
-            for (const auto& tt : wait_) {
-                printf("%s/%d ", tt->stateStr().c_str(), tt->nexttime_);
-            }
-            printf("\n");
-#endif
+RunResult runReplication(const SweepOptions& opts, int point, int rep, bool antithetic, UserStatistics& pooled)
+{
+    std::unique_ptr<ElevatorSimulation> simp;  // too big for a thread's stack in tall buildings
+    if (opts.warmStart != nullptr) {
+        simp = opts.warmStart->fork();
+        simp->reseed(opts.seed + rep);
+        simp->resetStatistics();
+    } else {
+        simp = std::make_unique<ElevatorSimulation>(opts.seed + rep);
+    }
+    ElevatorSimulation& sim = *simp;
+    sim.trace_ = false;
+    sim.commonRandomNumbers_ = opts.commonRandomNumbers;
+    sim.antithetic_ = antithetic;
+    sim.antitheticPair_ = opts.antithetic;
+    sim.traffic_ = opts.traffic;
+    sim.moduloBounded_ = opts.moduloBounded;
+    for (int a = 0; a < int(opts.axes.size()); ++a) {
+        sim.*(opts.axes[a].param->field) = opts.valueAt(point, a);
+    }
+    sim.runUntil(sim.now_ + opts.deadline);
+
+    const UserStatistics& stats = sim.stats_;
+    RunResult r;
+    r.queued = stats.queued_;
+    r.walked = stats.walked_;
+    r.arrived = stats.arrived();
+    if (r.queued != 0) {
+        r.walkawayRate = double(r.walked) / r.queued;
+    }
+    r.meanQueueTime = stats.queueTime_.mean();
+    r.meanRideTime = stats.rideTime_.mean();
+    r.meanCarLoad = sim.occupancy_.average(sim.occupancy_.carLoad_);
+    r.idleFraction = sim.occupancy_.average(sim.occupancy_.elevatorStep_[1]);
+    pooled.merge(stats);
+    return r;
+}
 
-            t->resume(*this);
+// The results of a sweep, collected one run at a time (from any thread),
+// and written out as one CSV row per point as soon as all of that point's
+// runs are in.
+struct SweepTable {
+    explicit SweepTable(const SweepOptions& opts) :
+        opts_(opts),
+        points_(opts.numberOfPoints()),
+        reps_(opts.replications),
+        runsPerRep_(opts.antithetic ? 2 : 1),
+        results_(size_t(points_) * reps_ * runsPerRep_),
+        remaining_(new std::atomic<int>[points_])
+    {
+        for (int i = 0; i < points_; ++i) {
+            remaining_[i] = reps_ * runsPerRep_;
         }
     }
 
-    struct NewUserInfo {
-        Floor in_;             // floor on which this user enters
-        Floor out_;            // this user's destination floor
-        Duration giveuptime_;  // amount of time this user will wait
-        Duration intertime_;   // amount of time before next user arrives
-    };
+    int jobs() const { return points_ * reps_ * runsPerRep_; }
+    int pointOf(int job) const { return job / (reps_ * runsPerRep_); }
+    int repOf(int job) const { return (job / runsPerRep_) % reps_; }
+    bool isAntithetic(int job) const { return (job % runsPerRep_ == 1); }
 
-    NewUserInfo createNewUser() {
-#if USE_KNUTH_DATA
-        static const NewUserInfo data[] = {
-            { 0, 2, 152-0,     38 -    0 },
-            { 4, 1, 36000,    136 -   38 },
-            { 2, 1, 36000,    141 -  136 },
-            { 2, 1, 36000,    291 -  141 },
-            { 3, 1, 36000,    364 -  291 },
-            { 2, 1, 540-364,  602 -  364 },
-            { 1, 2, 36000,    827 -  602 },
-            { 1, 0, 36000,    876 -  827 },
-            { 1, 3, 36000,   1048 -  876 },
-            { 0, 4, 36000,   4384 - 1048 },
-            { 2, 3, 36000,   4845 - 4384 },  // Knuth's "User 17"
-        };
-        static int i = 0;
-        if (i < 11) return data[i++];
-#endif
-        auto random_between = [&](int lo, int hi) {
-            return lo + (rand_() % (1 + hi - lo));
-        };
-        Floor in = random_between(0, 4);
-        Floor out = (in + random_between(1, 4)) % 5;
-        Duration giveup = random_between(300, 1200);
-        Duration intertime = random_between(10, 900);
-        return NewUserInfo{ in, out, giveup, intertime };
-    }
-
-    void schedule(std::shared_ptr<Task> t, int step, Time when) {
-        t->nextinst_ = step;
-        t->nexttime_ = when;
-        std_erase(wait_, t);
-        wait_.push_back(t);
-        std::stable_sort(wait_.begin(), wait_.end(), Task::ByNextTime());
-    }
-
-    void schedule_immediately(std::shared_ptr<Task> t, int step, Time when) {
-        t->nextinst_ = step;
-        t->nexttime_ = when;
-        std_erase(wait_, t);
-        wait_.push_front(t);
-        assert(std::is_sorted(wait_.begin(), wait_.end(), Task::ByNextTime()));
-    }
-
-    void cancel(std::shared_ptr<Task> t) {
-        std_erase(wait_, t);
-    }
-
-    void decision(Time now, bool fromE6) {
-        // D1. Decision necessary?
-        if (state_ != Neutral) {
-            return;
-        }
-        // D2. Should doors open?
-        if (elevatortask_->nextinst_ == 1 && (callup_[2] || calldown_[2] || callcar_[2])) {
-            this->schedule(elevatortask_, 3, now + durationOfDoorOpenFromDecisionSubroutine);
-            return;
-        }
-        // D3. Any calls?
-        int jj = (fromE6 ? 2 : -1);
-        for (int j=0; j < 5; ++j) {
-            if (j == floor_) {
+    void writeHeader() {
+        FILE *out = opts_.out;
+        fprintf(out, "point");
+        for (const auto& axis : opts_.axes) {
+            fprintf(out, ",%s", axis.param->name);
+        }
+        fprintf(out, ",reps,users,walkaway_rate,walkaway_rate_se,queue_time,queue_time_se,ride_time,ride_time_se,car_load,idle_fraction");
+        if (opts_.antithetic) {
+            fprintf(out, ",walkaway_rate_vrf,queue_time_vrf,ride_time_vrf");
+        }
+        if (opts_.processes > 0) {
+            fprintf(out, ",failed_runs");
+        }
+        fprintf(out, "\n");
+        fflush(out);
+    }
+
+    // Thread-safe, as long as each job is recorded only once.
+    void record(int job, const RunResult& r) {
+        results_[job] = r;
+        int point = this->pointOf(job);
+        if (remaining_[point].fetch_sub(1) == 1) {
+            this->writeRow(point);
+        }
+    }
+
+private:
+    void writeRow(int point) {
+        // A replication's estimate is the average over its runs (that is,
+        // over its antithetic pair, if any). `singles` sees each run on its
+        // own, so that we can report the achieved variance reduction factor:
+        // how many times more independent runs it would have taken to get
+        // the same standard error. Replications with a failed run are left out.
+        RunningStats users, carLoad, idle, estimate[3], singles[3];
+        int failed = 0;
+        for (int rep = 0; rep < reps_; ++rep) {
+            const RunResult *r = &results_[(size_t(point) * reps_ + rep) * runsPerRep_];
+            bool ok = true;
+            for (int k = 0; k < runsPerRep_; ++k) {
+                failed += r[k].failed;
+                ok = ok && !r[k].failed;
+            }
+            if (!ok) {
                 continue;
             }
-            if (callup_[j] || calldown_[j] || callcar_[j]) {
-                jj = j;
-                break;
+            double sum[3] = {};
+            for (int k = 0; k < runsPerRep_; ++k) {
+                double x[3] = { r[k].walkawayRate, r[k].meanQueueTime, r[k].meanRideTime };
+                for (int m = 0; m < 3; ++m) {
+                    singles[m].add(x[m]);
+                    sum[m] += x[m];
+                }
+                users.add(double(r[k].queued));
+                carLoad.add(r[k].meanCarLoad);
+                idle.add(r[k].idleFraction);
+            }
+            for (int m = 0; m < 3; ++m) {
+                estimate[m].add(sum[m] / runsPerRep_);
             }
         }
-        if (jj != -1) {
-            // D4. Set STATE.
-            state_ = (jj < floor_) ? GoingDown : (jj > floor_) ? GoingUp : Neutral;
-            // D5. Elevator dormant?
-            if (elevatortask_->nextinst_ == 1 && jj != 2) {
-                this->schedule(elevatortask_, 6, now + delayBeforeHoming);
+        std::lock_guard<std::mutex> lk(outputMutex_);
+        FILE *out = opts_.out;
+        fprintf(out, "%d", point);
+        for (int a = 0; a < int(opts_.axes.size()); ++a) {
+            fprintf(out, ",%lld", opts_.valueAt(point, a));
+        }
+        fprintf(out, ",%d,%.1f,%.6f,%.6f,%.3f,%.3f,%.3f,%.3f", int(estimate[0].count()), users.mean(),
+            estimate[0].mean(), estimate[0].stderror(), estimate[1].mean(), estimate[1].stderror(),
+            estimate[2].mean(), estimate[2].stderror());
+        fprintf(out, ",%.4f,%.4f", carLoad.mean(), idle.mean());
+        if (opts_.antithetic) {
+            for (int m = 0; m < 3; ++m) {
+                double v = runsPerRep_ * estimate[m].variance();
+                fprintf(out, ",%.3f", (v > 0) ? singles[m].variance() / v : 0.0);
             }
         }
+        if (opts_.processes > 0) {
+            fprintf(out, ",%d", failed);
+        }
+        fprintf(out, "\n");
+        fflush(out);
     }
+
+    const SweepOptions& opts_;
+    int points_;
+    int reps_;
+    int runsPerRep_;
+    std::vector<RunResult> results_;
+    std::unique_ptr<std::atomic<int>[]> remaining_;
+    std::mutex outputMutex_;
 };
 
+std::unique_ptr<UserStatistics> runSweepInThreads(const SweepOptions& opts, SweepTable& table)
+{
+    const int jobs = table.jobs();
+    std::atomic<int> nextJob{0};
+
+    // Each worker pools the per-user statistics of its own runs in a local
+    // UserStatistics, and publishes a copy into its own slot after each run,
+    // so that the only locking is once per run, and never between workers.
+    struct PublishedStats {
+        std::mutex mutex_;
+        UserStatistics stats_;
+        char padding_[64];  // keep neighboring slots' mutexes off each other's cache lines
+    };
+    std::unique_ptr<PublishedStats[]> published(new PublishedStats[opts.threads]);
+    std::atomic<int> runsDone{0};
+    std::atomic<int> workersRunning{opts.threads};
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+
+    auto snapshot = [&]() {
+        auto total = std::make_unique<UserStatistics>();
+        for (int i = 0; i < opts.threads; ++i) {
+            std::lock_guard<std::mutex> lk(published[i].mutex_);
+            total->merge(published[i].stats_);
+        }
+        return total;
+    };
 
-    void UserTask::resume(ElevatorSimulation& sim) {
-        Time now = this->nexttime_;
-        std::shared_ptr<UserTask> me = shared_user_from_this();
-#if EXERCISE_SIX
-        auto elevator_is_available = [&](Floor in, Floor out) {
-            Direction avoid = (out < in) ? GoingUp : GoingDown;
-            return (sim.floor_ == in) && (sim.state_ != avoid);
-        };
-#else
-        auto elevator_is_available = [&](Floor in, Floor) {
-            return (sim.floor_ == in);
-        };
-#endif
-        switch (this->nextinst_) {
-            case 1: {
-                // U1. Enter, prepare for successor.
-                auto info = sim.createNewUser();
-                sim.schedule(std::make_shared<UserTask>(), 1, now + info.intertime_);
-                // U2. Signal and wait.
-                assert(info.in_ != info.out_);
-                if (elevator_is_available(info.in_, info.out_) && sim.elevatortask_->nextinst_ == 6) {
-                    sim.schedule_immediately(sim.elevatortask_, 3, now);
-                } else if (elevator_is_available(info.in_, info.out_) && sim.d3_) {
-                    sim.d3_ = false;
-                    sim.d1_ = true;
-                    sim.schedule_immediately(sim.elevatortask_, 4, now);
-                } else {
-                    if (info.in_ < info.out_) {
-                        sim.callup_[info.in_] = true;
-                    } else {
-                        sim.calldown_[info.in_] = true;
-                    }
-                    if (!sim.d2_ || sim.elevatortask_->nextinst_ == 1) {
-                        sim.decision(now, false);
-                    }
-                }
-                // U3. Enter queue.
-                this->in_ = info.in_;
-                this->out_ = info.out_;
-                sim.queue_[this->in_].push_back(me);
-                sim.schedule(me, 4, now + info.giveuptime_);
-#if PRINT_STATISTICS
-                this->enteredQueueAt_ = now;
-#endif
-                return;
-            }
-            case 4: {
-                // U4. Give up.
-                if (!elevator_is_available(this->in_, this->out_) || !sim.d1_) {
-                    std_erase(sim.queue_[this->in_], me);
-#if PRINT_STATISTICS
-                    Duration d = now - this->enteredQueueAt_;
-                    printf("User %d walked after %d.%ds waiting in the queue on floor %d\n", this->userNumber_, d / 10, d % 10, this->in_);
-#endif
-                }
-                return;
-            }
-            case 5: {
-                // U5. Get in.
-                std_erase(sim.queue_[this->in_], me);
-                sim.elevator_.push_front(me);
-                sim.callcar_[this->out_] = true;
-                if (sim.state_ == Neutral) {
-                    sim.state_ = (this->in_ < this->out_) ? GoingUp : GoingDown;
-                    sim.schedule(sim.e5task_, 5, now + sim.durationBeforeRapidDoorClose);
-                }
-#if PRINT_STATISTICS
-                this->enteredCarAt_ = now;
-                for (auto& user : sim.elevator_) {
-                    user->maxOccupancy_ = std::max(user->maxOccupancy_, int(sim.elevator_.size()));
-                }
-#endif
-                return;
-            }
-            case 6: {
-                // U6. Get out.
-                std_erase(sim.elevator_, me);
-#if PRINT_STATISTICS
-                Duration d1 = this->enteredCarAt_ - this->enteredQueueAt_;
-                Duration d2 = now - this->enteredCarAt_;
-                printf("User %d arrived after %d.%ds waiting in the queue on floor %d followed by %d.%ds in the elevator. Max occupancy %d. Stopped at floors",
-                    this->userNumber_, d1 / 10, d1 % 10, this->in_, d2 / 10, d2 % 10, this->maxOccupancy_);
-                for (Floor f : this->stoppedAt_) {
-                    printf(" %d", f);
-                }
-                printf(".\n");
-#endif
-                return;
+    auto worker = [&](int index) {
+        auto pooled = std::make_unique<UserStatistics>();
+        while (true) {
+            int job = nextJob.fetch_add(1);
+            if (job >= jobs) {
+                break;
             }
+            table.record(job, runReplication(opts, table.pointOf(job), table.repOf(job), table.isAntithetic(job), *pooled));
+            std::lock_guard<std::mutex> lk(published[index].mutex_);
+            published[index].stats_ = *pooled;
+            runsDone += 1;
+        }
+        if (workersRunning.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lk(doneMutex);
+            doneCv.notify_all();
         }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opts.threads; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    if (opts.progressInterval > 0) {
+        std::unique_lock<std::mutex> lk(doneMutex);
+        while (!doneCv.wait_for(lk, std::chrono::seconds(opts.progressInterval), [&]() { return workersRunning == 0; })) {
+            char label[100];
+            snprintf(label, sizeof label, "after %d of %d runs", int(runsDone), jobs);
+            snapshot()->print(stderr, label);
+        }
+    }
+    for (auto& t : threads) {
+        t.join();
     }
+    return snapshot();
+}
 
-    void ElevatorTask::resume(ElevatorSimulation& sim) {
-        Time now = this->nexttime_;
-        std::shared_ptr<Task> me = shared_from_this();
-        assert(me == sim.elevatortask_);
-        switch (this->nextinst_) {
-            case 1: {
-                // E1. Wait for call.
-                assert(sim.floor_ == 2);
+// Run the sweep in forked worker processes, so that a configuration which
+// crashes (say, on an assertion) is retried once and then reported as failed,
+// instead of killing the whole batch.
+std::unique_ptr<UserStatistics> runSweepInProcesses(const SweepOptions& opts, SweepTable& table)
+{
+    ProcessEnsemble ensemble(opts.processes, table.jobs());
+    auto pooled = std::make_unique<UserStatistics>();
+    int runsDone = 0;
+    auto lastProgress = std::chrono::steady_clock::now();
+    auto countRun = [&]() {
+        runsDone += 1;
+        auto now = std::chrono::steady_clock::now();
+        if (opts.progressInterval > 0 && now - lastProgress >= std::chrono::seconds(opts.progressInterval)) {
+            char label[100];
+            snprintf(label, sizeof label, "after %d of %d runs", runsDone, table.jobs());
+            pooled->print(stderr, label);
+            lastProgress = now;
+        }
+    };
+    auto recordFailure = [&](int job) {
+        RunResult failed;
+        failed.failed = true;
+        table.record(job, failed);
+        countRun();
+    };
+    // Each run's result goes back to the parent as a snapshot of its
+    // RunResult and UserStatistics.
+    ensemble.run(2,
+        [&](int job) {
+            auto stats = std::make_unique<UserStatistics>();
+            RunResult run = runReplication(opts, table.pointOf(job), table.repOf(job), table.isAntithetic(job), *stats);
+            SnapshotWriter w;
+            w.io(run);
+            UserStatistics::transfer(*stats, w);
+            return w.bytes();
+        },
+        [&](int job, const std::vector<char>& bytes) {
+            auto stats = std::make_unique<UserStatistics>();
+            RunResult run;
+            SnapshotReader r(bytes.data(), bytes.size());
+            r.io(run);
+            UserStatistics::transfer(*stats, r);
+            if (!r.ok() || !r.atEnd()) {
+                fprintf(stderr, "The result of job %d is truncated or corrupt\n", job);
+                recordFailure(job);
                 return;
             }
-            case 2: {
-                // E2. Change of state?
-                bool passenger_wants_up = false;
-                bool passenger_wants_down = false;
-                bool waiter_wants_up = false;
-                bool waiter_wants_down = false;
-                for (int j=0; j < 5; ++j) {
-                    if (j != sim.floor_) {
-                        if (sim.callcar_[j]) {
-                            ((j > sim.floor_) ? passenger_wants_up : passenger_wants_down) = true;
-                        }
-                        if (sim.callup_[j] || sim.calldown_[j]) {
-                            ((j > sim.floor_) ? waiter_wants_up : waiter_wants_down) = true;
-                        }
-                    }
-                }
-                if (sim.state_ == GoingUp && !(passenger_wants_up || waiter_wants_up)) {
-                    sim.state_ = (passenger_wants_down ? GoingDown : Neutral);
-                } else if (sim.state_ == GoingDown && !(passenger_wants_down || waiter_wants_down)) {
-                    sim.state_ = (passenger_wants_up ? GoingUp : Neutral);
-                }
-                goto caseE3;
+            pooled->merge(*stats);
+            table.record(job, run);
+            countRun();
+        },
+        recordFailure
+    );
+    return pooled;
+}
+
+// Check that every point of the sweep makes sense together with the
+// parameters it doesn't vary (those of the warm start, if any): each
+// minimum no more than its maximum, and users a positive time apart.
+// Returns false, having printed the first bad point, otherwise.
+bool validateSweep(const SweepOptions& opts)
+{
+    auto base = (opts.warmStart != nullptr) ? opts.warmStart->fork() : std::make_unique<ElevatorSimulation>();
+    ElevatorSimulation& sim = *base;
+    for (int point = 0; point < opts.numberOfPoints(); ++point) {
+        for (int a = 0; a < int(opts.axes.size()); ++a) {
+            sim.*(opts.axes[a].param->field) = opts.valueAt(point, a);
+        }
+        const char *problem = nullptr;
+        if (sim.minGiveupTime > sim.maxGiveupTime) {
+            problem = "minGiveupTime exceeds maxGiveupTime";
+        } else if (sim.minInterarrivalTime > sim.maxInterarrivalTime) {
+            problem = "minInterarrivalTime exceeds maxInterarrivalTime";
+        } else if (sim.maxInterarrivalTime <= 0) {
+            problem = "maxInterarrivalTime must be positive";
+        }
+        if (problem != nullptr) {
+            fprintf(stderr, "Bad sweep point %d (", point);
+            for (int a = 0; a < int(opts.axes.size()); ++a) {
+                fprintf(stderr, "%s%s=%lld", (a == 0) ? "" : ", ", opts.axes[a].param->name, opts.valueAt(point, a));
             }
-            case 3: caseE3: {
-                // E3. Open doors.
-                sim.d1_ = true;
-                sim.d2_ = true;
-                sim.schedule(sim.e9task_, 9, now + sim.durationBeforeInactivity);
-                sim.schedule(sim.e5task_, 5, now + sim.durationBeforeDoorClose);
-                sim.schedule(me, 4, now + sim.durationOfDoorOpen);
-#if PRINT_STATISTICS
-                for (const auto& user : sim.elevator_) {
-                    user->stoppedAt_.push_back(sim.floor_);
-                }
-#endif
-                return;
+            fprintf(stderr, "): %s\n", problem);
+            return false;
+        }
+    }
+    return true;
+}
+
+void runSweep(const SweepOptions& opts)
+{
+    SweepTable table(opts);
+    table.writeHeader();
+    auto pooled = (opts.processes > 0) ? runSweepInProcesses(opts, table) : runSweepInThreads(opts, table);
+    pooled->print(stderr, "pooled over all runs");
+    if (opts.histograms != nullptr) {
+        pooled->dumpHistograms(opts.histograms);
+    }
+}
+
+// Benchmarks.
+//
+//     ./go --bench [scenario ...]
+//
+// runs each named scenario (by default, every scenario that fits this
+// build's number of floors) in a forked child process, so that each gets
+// its own peak memory measurement, and prints one JSON object per scenario,
+// separated by commas. `make bench` collects them into an array in bench.json.
+
+struct BenchScenario {
+    const char *name;
+    bool tall;         // meant for builds with more than five floors
+    int minFloors;     // can't run in a building with fewer floors
+    Time deadline;
+    int runs;          // fresh simulations to run back to back
+    void (*configure)(ElevatorSimulation&);
+};
+
+static const BenchScenario benchScenarios[] = {
+    { "knuth", false, 5, 4841, 2000, [](ElevatorSimulation& sim) {
+        sim.useKnuthData_ = true;
+    }},
+    { "light", false, 2, 3600000, 10, [](ElevatorSimulation&) {
+    }},
+    { "saturated", false, 2, 360000, 4, [](ElevatorSimulation& sim) {
+        sim.minInterarrivalTime = 10;
+        sim.maxInterarrivalTime = 60;
+        sim.minGiveupTime = 6000;
+        sim.maxGiveupTime = 36000;
+    }},
+    { "long-horizon", false, 2, 315360000, 1, [](ElevatorSimulation&) {
+    }},
+    { "tall-building", true, 2, 3600000, 4, [](ElevatorSimulation& sim) {
+        sim.maxInterarrivalTime = 300;
+    }},
+};
+
+void runBenchScenario(const BenchScenario& b)
+{
+    long long events = 0;
+    long long users = 0;
+    long long peakLiveUsers = 0;
+    long long peakDequeBytes = 0;
+    AllocationCounts before = allocationCounts();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < b.runs; ++i) {
+        auto sim = std::make_unique<ElevatorSimulation>(i);
+        sim->trace_ = false;
+        b.configure(*sim);
+        sim->runUntil(b.deadline);
+        events += sim->eventsProcessed_;
+        users += sim->usersCreated_;
+        const MemoryStatistics& m = sim->memory_;
+        peakLiveUsers = std::max(peakLiveUsers, m.users_.peakBlocks_);
+        peakDequeBytes = std::max(peakDequeBytes, m.wait_.peakBytes_ + m.queues_.peakBytes_ + m.elevator_.peakBytes_);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    long long allocations = allocationCounts().allocations_ - before.allocations_;
+    long long bytes = allocationCounts().bytes_ - before.bytes_;
+    char counted[200] = "\"allocations\": null, \"allocated_bytes\": null, \"allocations_per_event\": null";
+    if (COUNT_ALLOCATIONS) {
+        snprintf(counted, sizeof counted, "\"allocations\": %lld, \"allocated_bytes\": %lld, \"allocations_per_event\": %.3f",
+            allocations, bytes, double(allocations) / events);
+    }
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("  {\"scenario\": \"%s\", \"floors\": %d, \"runs\": %d, \"deadline\": %lld, \"events\": %lld, \"users\": %lld,"
+        " \"seconds\": %.6f, \"events_per_second\": %.0f, \"ns_per_event\": %.2f, \"peak_rss_kb\": %ld,"
+        " %s, \"peak_live_users\": %lld, \"peak_deque_bytes\": %lld}",
+        b.name, numberOfFloors, b.runs, (long long)b.deadline, events, users,
+        seconds, events / seconds, 1e9 * seconds / events, ru.ru_maxrss,
+        counted, peakLiveUsers, peakDequeBytes);
+}
+
+int runBenchmarks(const std::vector<const char*>& names)
+{
+    std::vector<const BenchScenario*> selected;
+    for (const auto& b : benchScenarios) {
+        bool fits = (numberOfFloors >= b.minFloors);
+        bool wanted = names.empty() ? (fits && b.tall == (numberOfFloors > 5)) : false;
+        for (const char *name : names) {
+            if (strcmp(name, b.name) == 0 && !fits) {
+                fprintf(stderr, "The %s scenario needs at least %d floors\n", b.name, b.minFloors);
+                return 1;
             }
-            case 4: {
-                // E4. Let people out, in.
-                assert(sim.d1_);
-                auto leaver = std::find_if(sim.elevator_.begin(), sim.elevator_.end(), [&](const auto& p) {
-                    return p->out_ == sim.floor_;
-                });
-                auto enterer = std::find_if(sim.queue_[sim.floor_].begin(), sim.queue_[sim.floor_].end(), [&](const auto& p) {
-#if EXERCISE_SIX
-                    return (sim.state_ == Neutral) || ((p->out_ > sim.floor_) == (sim.state_ == GoingUp));
-#else
-                    (void)p;
-                    return true;
-#endif
-                });
-                if (leaver != sim.elevator_.end()) {
-                    sim.schedule_immediately(*leaver, 6, now);
-                    sim.schedule(me, 4, now + sim.durationOfLeaving);
-                } else if (enterer != sim.queue_[sim.floor_].end()) {
-                    assert((*enterer)->nextinst_ == 4);
-                    sim.schedule_immediately(*enterer, 5, now);
-                    sim.schedule(me, 4, now + sim.durationOfEntering);
-                } else {
-                    sim.d1_ = false;
-                    sim.d3_ = true;
-                }
-                return;
+            wanted = wanted || (strcmp(name, b.name) == 0);
+        }
+        if (wanted) {
+            selected.push_back(&b);
+        }
+    }
+    if (selected.size() != (names.empty() ? selected.size() : names.size())) {
+        fprintf(stderr, "Unknown benchmark scenario; the scenarios are:");
+        for (const auto& b : benchScenarios) {
+            fprintf(stderr, " %s", b.name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    for (size_t i = 0; i < selected.size(); ++i) {
+        if (i != 0) {
+            printf(",\n");
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            runBenchScenario(*selected[i]);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Benchmark scenario %s failed\n", selected[i]->name);
+            return 1;
+        }
+    }
+    printf("\n");
+    return 0;
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [deadline] [--knuth | --arrivals file | --traffic office|file] [--compare golden.trace] [--summary] [--memory] [--user-records file] [--profile] [--perf | --perf-steps] [--histograms file.csv] [--seed N] [--crn] [--antithetic] [--modulo]\n", argv0);
+    fprintf(stderr, "           [--restore checkpoint] [--warmup T] [--save-checkpoint checkpoint]\n");
+    fprintf(stderr, "       %s [deadline] --sweep name=v1,v2,... [--sweep name=lo:hi:step ...]\n", argv0);
+    fprintf(stderr, "           [--reps N] [--threads N | --processes N] [--seed N] [--crn] [--antithetic] [--modulo]\n");
+    fprintf(stderr, "           [--traffic office|file] [--restore checkpoint] [--warmup T]\n");
+    fprintf(stderr, "           [--progress SECONDS] [--histograms file.csv] [--out file.csv]\n");
+    fprintf(stderr, "       %s --bench [scenario ...]\n", argv0);
+    fprintf(stderr, "       %s --convert-arrivals arrivals.csv arrivals.bin\n", argv0);
+    fprintf(stderr, "Sweepable parameters:");
+    for (const auto& p : sweepParameters) {
+        fprintf(stderr, " %s", p.name);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    Time deadline = 3600'0;
+    bool sweeping = false;
+    bool summary = false;
+    bool profile = false;
+    bool memory = false;
+    bool knuth = USE_KNUTH_DATA;
+    std::unique_ptr<TraceComparator> comparator;
+    const char *arrivalsPath = nullptr;
+    std::unique_ptr<TrafficProfile> traffic;
+    UserRecordSink userRecords;
+    bool recordUsers = false;
+    const char *restorePath = nullptr;
+    const char *checkpointPath = nullptr;
+    Time warmup = 0;
+    enum { NoPerf, PerfPerRun, PerfPerStep } perfMode = NoPerf;
+    SweepOptions sweep;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (strcmp(arg, "--sweep") == 0 && hasValue) {
+            SweepAxis axis;
+            if (!parseSweepAxis(argv[++i], axis)) {
+                fprintf(stderr, "Bad sweep specification '%s'\n", argv[i]);
+                usage(argv[0]);
             }
-            case 6: {
-                // E6. Prepare to move.
-                assert(!sim.d1_);
-                sim.callcar_[sim.floor_] = false;
-                if (sim.state_ != GoingDown) {
-                    sim.callup_[sim.floor_] = false;
-                }
-                if (sim.state_ != GoingUp) {
-                    sim.calldown_[sim.floor_] = false;
-                }
-                sim.decision(now, true);
-                if (sim.state_ == Neutral) {
-                    assert(sim.floor_ == 2);
-                    assert(std::find(sim.wait_.begin(), sim.wait_.end(), me) == sim.wait_.end());
-                    sim.schedule_immediately(me, 1, now);
-                } else {
-                    if (sim.d2_) {
-                        sim.cancel(sim.e9task_);
-                    }
-                    if (sim.state_ == GoingUp) {
-                        sim.schedule(me, 7, now + sim.durationOfUpwardAcceleration);
-                    } else {
-                        sim.schedule(me, 8, now + sim.durationOfDownwardAcceleration);
-                    }
-                }
-                return;
+            sweep.axes.push_back(axis);
+            sweeping = true;
+        } else if (strcmp(arg, "--reps") == 0 && hasValue) {
+            sweep.replications = std::max(1, atoi(argv[++i]));
+            sweeping = true;
+        } else if (strcmp(arg, "--threads") == 0 && hasValue) {
+            sweep.threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(arg, "--processes") == 0 && hasValue) {
+            sweep.processes = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+            sweep.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--memory") == 0) {
+            memory = true;
+        } else if (strcmp(arg, "--profile") == 0) {
+            profile = true;
+        } else if (strcmp(arg, "--perf") == 0) {
+            perfMode = PerfPerRun;
+        } else if (strcmp(arg, "--perf-steps") == 0) {
+            perfMode = PerfPerStep;
+        } else if (strcmp(arg, "--bench") == 0) {
+            std::vector<const char*> names(argv + i + 1, argv + argc);
+            return runBenchmarks(names);
+        } else if (strcmp(arg, "--compare") == 0 && hasValue) {
+            comparator.reset(new TraceComparator(argv[++i]));
+            if (!comparator->load()) {
+                return 1;
             }
-            case 7: {
-                // E7. Go up a floor.
-                assert(!sim.d1_);
-                assert(sim.floor_ < 4);
-                sim.floor_ += 1;
-                sim.schedule(me, 71, now + sim.durationOfUpwardTravel);
-                return;
+        } else if (strcmp(arg, "--arrivals") == 0 && hasValue) {
+            arrivalsPath = argv[++i];
+        } else if (strcmp(arg, "--convert-arrivals") == 0 && i + 2 < argc) {
+            long long n = writeBinaryArrivals(argv[i + 1], argv[i + 2], numberOfFloors);
+            if (n < 0) {
+                return 1;
             }
-            case 71: {
-                // E7, continued.
-                bool passenger_wants_up = false;
-                bool passenger_wants_down = false;
-                bool waiter_wants_up = false;
-                bool waiter_wants_down = false;
-                for (int j=0; j < 5; ++j) {
-                    if (j != sim.floor_) {
-                        if (sim.callcar_[j]) {
-                            ((j > sim.floor_) ? passenger_wants_up : passenger_wants_down) = true;
-                        }
-                        if (sim.callup_[j] || sim.calldown_[j]) {
-                            ((j > sim.floor_) ? waiter_wants_up : waiter_wants_down) = true;
-                        }
-                    }
-                }
-                bool should_stop_here = sim.callcar_[sim.floor_] ||
-                    sim.callup_[sim.floor_] ||
-                    ((sim.floor_ == 2 || sim.calldown_[sim.floor_]) && !(passenger_wants_up || waiter_wants_up));
-                if (should_stop_here) {
-                    sim.schedule(me, 2, now + sim.durationOfUpwardDeceleration);
-                } else {
-                    sim.schedule_immediately(me, 7, now);
+            fprintf(stderr, "Wrote %lld arrivals to %s\n", n, argv[i + 2]);
+            return 0;
+        } else if (strcmp(arg, "--traffic") == 0 && hasValue) {
+            const char *name = argv[++i];
+            if (strcmp(name, "office") == 0) {
+                traffic.reset(new TrafficProfile(TrafficProfile::office(numberOfFloors)));
+            } else {
+                traffic.reset(new TrafficProfile(numberOfFloors));
+                if (!traffic->load(name)) {
+                    return 1;
                 }
-                return;
             }
-            case 8: {
-                // E8. Go down a floor.
-                assert(!sim.d1_);
-                assert(sim.floor_ > 0);
-                sim.floor_ -= 1;
-                sim.schedule(me, 81, now + sim.durationOfDownwardTravel);
-                return;
+            sweep.traffic = traffic.get();
+        } else if (strcmp(arg, "--user-records") == 0 && hasValue) {
+            if (!userRecords.open(argv[++i])) {
+                return 1;
             }
-            case 81: {
-                // E8, continued.
-                bool passenger_wants_up = false;
-                bool passenger_wants_down = false;
-                bool waiter_wants_up = false;
-                bool waiter_wants_down = false;
-                for (int j=0; j < 5; ++j) {
-                    if (j != sim.floor_) {
-                        if (sim.callcar_[j]) {
-                            ((j > sim.floor_) ? passenger_wants_up : passenger_wants_down) = true;
-                        }
-                        if (sim.callup_[j] || sim.calldown_[j]) {
-                            ((j > sim.floor_) ? waiter_wants_up : waiter_wants_down) = true;
-                        }
-                    }
-                }
-                bool should_stop_here = sim.callcar_[sim.floor_] ||
-                    sim.calldown_[sim.floor_] ||
-                    ((sim.floor_ == 2 || sim.callup_[sim.floor_]) && !(passenger_wants_down || waiter_wants_down));
-                if (should_stop_here) {
-                    sim.schedule(me, 2, now + sim.durationOfDownwardDeceleration);
-                } else {
-                    sim.schedule_immediately(me, 8, now);
-                }
-                return;
+            recordUsers = true;
+        } else if (strcmp(arg, "--restore") == 0 && hasValue) {
+            restorePath = argv[++i];
+        } else if (strcmp(arg, "--save-checkpoint") == 0 && hasValue) {
+            checkpointPath = argv[++i];
+        } else if (strcmp(arg, "--warmup") == 0 && hasValue) {
+            warmup = std::max(0LL, atoll(argv[++i]));
+        } else if (strcmp(arg, "--knuth") == 0) {
+            knuth = true;
+        } else if (strcmp(arg, "--summary") == 0) {
+            summary = true;
+        } else if (strcmp(arg, "--crn") == 0) {
+            sweep.commonRandomNumbers = true;
+        } else if (strcmp(arg, "--antithetic") == 0) {
+            sweep.antithetic = true;
+        } else if (strcmp(arg, "--modulo") == 0) {
+            sweep.moduloBounded = true;
+        } else if (strcmp(arg, "--progress") == 0 && hasValue) {
+            sweep.progressInterval = std::max(0, atoi(argv[++i]));
+        } else if (strcmp(arg, "--histograms") == 0 && hasValue) {
+            sweep.histograms = fopen(argv[++i], "w");
+            if (sweep.histograms == nullptr) {
+                perror(argv[i]);
+                return 1;
             }
-            default: {
-                assert(false);
+        } else if (strcmp(arg, "--out") == 0 && hasValue) {
+            sweep.out = fopen(argv[++i], "w");
+            if (sweep.out == nullptr) {
+                perror(argv[i]);
+                return 1;
             }
+        } else if (arg[0] != '-') {
+            deadline = atoll(arg);
+        } else {
+            usage(argv[0]);
         }
     }
 
-    void E5Task::resume(ElevatorSimulation& sim) {
-        Time now = this->nexttime_;
-        std::shared_ptr<Task> me = shared_from_this();
-        assert(me == sim.e5task_);
-        assert(nextinst_ == 5);
-
-        // E5. Close doors.
-        if (sim.d1_) {
-            sim.schedule(me, 5, now + sim.delayAfterDoorFlutter);
-        } else {
-            sim.d3_ = false;
-            sim.schedule(sim.elevatortask_, 6, now + sim.durationOfDoorClose);
+    if (knuth && numberOfFloors < 5) {
+        fprintf(stderr, "--knuth needs at least five floors; this build has %d\n", numberOfFloors);
+        return 1;
+    }
+    if (sweeping && arrivalsPath != nullptr) {
+        fprintf(stderr, "--arrivals can't be combined with --sweep\n");
+        usage(argv[0]);
+    }
+    if (sweeping) {
+        // Warm up (or restore) one simulation, and fork every run from it.
+        std::unique_ptr<ElevatorSimulation> warm;
+        if (restorePath != nullptr || warmup > 0) {
+            warm = std::make_unique<ElevatorSimulation>(sweep.seed);
+            warm->trace_ = false;
+            warm->commonRandomNumbers_ = sweep.commonRandomNumbers;
+            warm->moduloBounded_ = sweep.moduloBounded;
+            warm->traffic_ = traffic.get();
+            if (restorePath != nullptr && !warm->restoreCheckpoint(restorePath)) {
+                return 1;
+            }
+            warm->runUntil(warm->now_ + warmup);
+            sweep.warmStart = warm.get();
+        }
+        sweep.deadline = deadline;
+        if (!validateSweep(sweep)) {
+            return 1;
         }
+        runSweep(sweep);
+        if (sweep.out != stdout) {
+            fclose(sweep.out);
+        }
+        if (sweep.histograms != nullptr) {
+            fclose(sweep.histograms);
+        }
+        return 0;
     }
 
-    void E9Task::resume(ElevatorSimulation& sim) {
-        Time now = this->nexttime_;
-        std::shared_ptr<Task> me = shared_from_this();
-        assert(me == sim.e9task_);
-        assert(nextinst_ == 9);
-
-        // E9. Set inaction indicator.
-        sim.d2_ = false;
-        sim.decision(now, false);
+    auto simp = std::make_unique<ElevatorSimulation>(sweep.seed);
+    ElevatorSimulation& sim = *simp;
+    sim.commonRandomNumbers_ = sweep.commonRandomNumbers;
+    sim.antithetic_ = sweep.antithetic;
+    sim.antitheticPair_ = sweep.antithetic;
+    sim.moduloBounded_ = sweep.moduloBounded;
+    sim.trace_ = !summary || (comparator != nullptr);
+    sim.compare_ = comparator.get();
+    sim.traffic_ = traffic.get();
+    sim.userRecords_ = recordUsers ? &userRecords : nullptr;
+    std::unique_ptr<ArrivalSource> arrivals;
+    FILE *arrivalsFile = nullptr;
+    if (arrivalsPath != nullptr && strcmp(arrivalsPath, "-") != 0 && MappedArrivalFile::isBinary(arrivalsPath)) {
+        auto mapped = std::make_unique<MappedArrivalFile>();
+        if (!mapped->open(arrivalsPath)) {
+            return 1;
+        }
+        arrivals = std::move(mapped);
+    } else if (arrivalsPath != nullptr) {
+        arrivalsFile = (strcmp(arrivalsPath, "-") == 0) ? stdin : fopen(arrivalsPath, "r");
+        if (arrivalsFile == nullptr) {
+            perror(arrivalsPath);
+            return 1;
+        }
+        arrivals = std::make_unique<CsvArrivalStream>(arrivalsFile, arrivalsPath, numberOfFloors);
+    }
+    if (arrivals != nullptr) {
+        sim.replayArrivals(arrivals.get());
+    }
+    sim.useKnuthData_ = knuth;
+    if (restorePath != nullptr) {
+        // The snapshot's parameters, random number options, and traffic state replace ours.
+        if (arrivals != nullptr) {
+            fprintf(stderr, "%s: can't replay recorded arrivals from a checkpoint\n", restorePath);
+            return 1;
+        }
+        if (!sim.restoreCheckpoint(restorePath)) {
+            return 1;
+        }
+    }
+    std::unique_ptr<PerfCounters> perf;
+    if (perfMode != NoPerf) {
+        perf.reset(new PerfCounters);
+        if (!perf->available()) {
+            fprintf(stderr, "Hardware performance counters are unavailable: %s\n", perf->error());
+            perf = nullptr;
+        }
+    }
+    if (profile || perfMode == PerfPerStep) {
+        sim.profile_.reset(new EventProfile);
+        sim.profile_->perf_ = (perfMode == PerfPerStep) ? perf.get() : nullptr;
+    }
+    if (perf != nullptr) {
+        perf->start();
+    }
+    if (warmup > 0) {
+        sim.runUntil(sim.now_ + warmup);
+        sim.resetStatistics();
+    }
+    sim.runUntil(sim.now_ + deadline);
+    if (perf != nullptr) {
+        perf->stop();
+        perf->read().print(stderr, "hardware counters for runUntil");
+    }
+    if (recordUsers && !userRecords.close()) {
+        return 1;
+    }
+    if (checkpointPath != nullptr && !sim.saveCheckpoint(checkpointPath)) {
+        return 1;
+    }
+    if (comparator != nullptr) {
+        bool ok = comparator->finish();
+        comparator->report(stderr);
+        if (!ok) {
+            return 1;
+        }
+    }
+    if (sim.profile_ != nullptr) {
+        sim.profile_->print(stderr);
+    }
+    if (memory) {
+        sim.memory_.print(stderr);
+    }
+    if (summary) {
+        sim.stats_.print(stdout, "summary");
+        sim.occupancy_.print(stdout);
+    }
+    if (sweep.histograms != nullptr) {
+        sim.stats_.dumpHistograms(sweep.histograms);
+        fclose(sweep.histograms);
+    }
+    if (arrivalsFile != nullptr && arrivalsFile != stdin) {
+        fclose(arrivalsFile);
     }
-
-
-int main(int argc, char **argv)
-{
-    ElevatorSimulation sim;
-    Time deadline = (argc >= 2) ? atoi(argv[1]) : 3600'0;
-    sim.runUntil(deadline);
 }
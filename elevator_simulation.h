@@ -0,0 +1,1612 @@
+#pragma once
+
+// The simulation itself: Knuth's elevator (TAOCP section 2.2.5) as tasks
+// scheduled on one wait list, with the statistics it gathers as it runs.
+// cxx14.cpp adds the command line, sweeps and benchmarks around it, and
+// rngbench.cpp includes it to time the simulation's own random user draws.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "arrival_trace.h"
+#include "counting_allocator.h"
+#include "perf_counters.h"
+#include "snapshot.h"
+#include "statistics.h"
+#include "trace_compare.h"
+#include "traffic.h"
+#include "user_records.h"
+#include "xoshiro256ss.h"
+#include "ziggurat.h"
+
+template<class T, class A>
+void std_erase(std::deque<T, A>& ctr, const T& value)
+{
+    assert(std::count(ctr.begin(), ctr.end(), value) <= 1);
+    auto it = std::find(ctr.begin(), ctr.end(), value);
+    if (it != ctr.end()) {
+        ctr.erase(it);
+    }
+}
+
+
+struct ElevatorSimulation;
+
+// Knuth's building has five floors, and the elevator rests at floor 2.
+// Compile with (say) -DFLOORS=20 -DHOME_FLOOR=0 to simulate a taller one.
+#ifndef FLOORS
+#define FLOORS 5
+#endif
+#ifndef HOME_FLOOR
+#define HOME_FLOOR 2
+#endif
+#ifndef USE_KNUTH_DATA
+#define USE_KNUTH_DATA 0
+#endif
+#ifndef PRINT_STATISTICS
+#define PRINT_STATISTICS 0
+#endif
+
+// Times are 64-bit: 2^31 tenths of a second would be only 6.8 years.
+using Floor = int;           // 0 through numberOfFloors-1
+using Time = long long;      // timestamp, in tenths of seconds
+using Duration = long long;  // duration, in tenths of seconds
+
+static_assert(sizeof(Time) >= sizeof(ArrivalRecord::time_), "Time must hold any recorded arrival time");
+
+constexpr Floor numberOfFloors = FLOORS;
+constexpr Floor homeFloor = HOME_FLOOR;
+static_assert(0 <= homeFloor && homeFloor < numberOfFloors, "HOME_FLOOR must be one of the floors");
+static_assert(!USE_KNUTH_DATA || numberOfFloors >= 5, "Knuth's data needs at least five floors");
+
+enum Direction { GoingUp, GoingDown, Neutral };
+
+struct Task : public std::enable_shared_from_this<Task> {
+    int nextinst_ = 1;
+    Time nexttime_ = -1;
+
+    struct ByNextTime {
+        template<class T>
+        bool operator()(const std::shared_ptr<T>& p, const std::shared_ptr<T>& q) const {
+            return p->nexttime_ < q->nexttime_;
+        }
+    };
+
+    virtual std::string stateStr() const = 0;
+    virtual bool isUser() const { return false; }
+    virtual void resume(ElevatorSimulation& sim) = 0;
+    virtual ~Task() = default;
+};
+
+inline unsigned long long readCycleCounter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Where the event loop spends its time, by task kind and step: E1 through
+// E81 for the elevator (and the E5 and E9 tasks), U1 through U6 for users.
+// Only allocated, and only updated, when profiling is turned on.
+struct EventProfile {
+    static constexpr int maxStep = 100;
+    long long events_[2][maxStep] = {};             // [isUser][step]
+    unsigned long long cycles_[2][maxStep] = {};    // spent in resume()
+    LogHistogram pendingEvents_;                    // wait_.size() before each event
+    double seconds_ = 0;                            // wall-clock time in runUntil
+
+    // If non-null, hardware counters are also read around each event.
+    PerfCounters *perf_ = nullptr;
+    PerfCounterValues perfByStep_[2][maxStep];
+
+    void print(FILE *fp) const {
+        long long events = 0;
+        unsigned long long cycles = 0;
+        for (int u = 0; u < 2; ++u) {
+            for (int i = 0; i < maxStep; ++i) {
+                events += events_[u][i];
+                cycles += cycles_[u][i];
+            }
+        }
+        fprintf(fp, "# profile: %lld events in %.3f seconds; %.0f events/second, %.1f ns/event\n",
+            events, seconds_, seconds_ ? events / seconds_ : 0.0, events ? 1e9 * seconds_ / events : 0.0);
+        fprintf(fp, "#   %-5s %12s %8s %14s %8s\n", "step", "events", "%", "cycles/event", "%cycles");
+        for (int u = 0; u < 2; ++u) {
+            for (int i = 0; i < maxStep; ++i) {
+                if (events_[u][i] != 0) {
+                    fprintf(fp, "#   %c%-4d %12lld %7.2f%% %14.1f %7.2f%%\n", "EU"[u], i, events_[u][i],
+                        100.0 * events_[u][i] / events, double(cycles_[u][i]) / events_[u][i],
+                        cycles ? 100.0 * cycles_[u][i] / cycles : 0.0);
+                }
+            }
+        }
+        if (perf_ != nullptr) {
+            fprintf(fp, "#   %-5s %6s %16s %16s\n", "step", "IPC", "cache misses/ev", "branch misses/ev");
+            for (int u = 0; u < 2; ++u) {
+                for (int i = 0; i < maxStep; ++i) {
+                    if (events_[u][i] != 0) {
+                        const PerfCounterValues& v = perfByStep_[u][i];
+                        fprintf(fp, "#   %c%-4d %6.2f %16.2f %16.2f\n", "EU"[u], i, v.ipc(),
+                            double(v[PerfCounterValues::CacheMisses]) / events_[u][i],
+                            double(v[PerfCounterValues::BranchMisses]) / events_[u][i]);
+                    }
+                }
+            }
+        }
+        const LogHistogram& h = pendingEvents_;
+        fprintf(fp, "#   pending events: p50 %.0f, p90 %.0f, p99 %.0f, max %.0f\n",
+            h.quantile(0.50), h.quantile(0.90), h.quantile(0.99), h.quantile(1.0));
+    }
+};
+
+struct ElevatorTask : public Task {
+    std::string stateStr() const override { return "E" + std::to_string(nextinst_); }
+    void resume(ElevatorSimulation& sim) override;
+};
+
+struct E5Task : public Task {
+    std::string stateStr() const override { return "E5"; }
+    void resume(ElevatorSimulation& sim) override;
+};
+
+struct E9Task : public Task {
+    std::string stateStr() const override { return "E9"; }
+    void resume(ElevatorSimulation& sim) override;
+};
+
+struct UserTask : public Task {
+    Floor in_ = 0;
+    Floor out_ = 0;
+    Time enteredQueueAt_ = 0;
+    Time enteredCarAt_ = 0;
+
+    explicit UserTask(int userNumber) : userNumber_(userNumber) {}
+
+    int userNumber_;
+    int maxOccupancy_ = 0;  // kept only for PRINT_STATISTICS or sim.userRecords_
+#if PRINT_STATISTICS
+    long long firstStop_ = 0;  // index into sim.stopLog_ of the first stop after boarding
+#endif
+
+    std::shared_ptr<UserTask> shared_user_from_this() {
+        return std::static_pointer_cast<UserTask>(this->shared_from_this());
+    }
+
+    std::string stateStr() const override { return "U" + std::to_string(nextinst_); }
+    bool isUser() const override { return true; }
+    void resume(ElevatorSimulation& sim) override;
+};
+
+// Per-user results, accumulated in O(1) per user. Each simulation owns one,
+// so the per-user updates never touch shared memory; results from different
+// simulations (or threads) are combined with merge(), in any order.
+struct UserStatistics {
+    long long queued_ = 0;
+    long long walked_ = 0;
+    RunningStats queueTime_;    // of users who arrived
+    RunningStats rideTime_;     // of users who arrived
+    RunningStats totalTime_;    // of users who arrived
+    RunningStats walkedAfter_;  // of users who walked away
+    LogHistogram queueTimeHistogram_;
+    LogHistogram rideTimeHistogram_;
+    LogHistogram totalTimeHistogram_;
+    LogHistogram walkedAfterHistogram_;
+
+    // Broken down by origin floor, and by origin and destination floor. Most
+    // pairs in a tall building see nobody in a given run, so each pair's
+    // histograms are allocated when its first user boards: pairIndex_[i][j]
+    // is 1 plus the position of pair (i, j) in the two vectors, or 0.
+    LogHistogram queueTimeByFloor_[numberOfFloors];
+    int32_t pairIndex_[numberOfFloors][numberOfFloors] = {};
+    std::vector<LogHistogram> queueTimeByPair_;
+    std::vector<LogHistogram> totalTimeByPair_;
+
+    long long arrived() const { return queueTime_.count(); }
+
+    int pairFor(Floor in, Floor out) {
+        int32_t& k = pairIndex_[in][out];
+        if (k == 0) {
+            queueTimeByPair_.emplace_back();
+            totalTimeByPair_.emplace_back();
+            k = int32_t(queueTimeByPair_.size());
+        }
+        return k - 1;
+    }
+
+    // The histograms for a pair, or nullptr if nobody has made that trip.
+    const LogHistogram *queueTimeByPair(Floor in, Floor out) const {
+        int k = pairIndex_[in][out];
+        return (k != 0) ? &queueTimeByPair_[k - 1] : nullptr;
+    }
+    const LogHistogram *totalTimeByPair(Floor in, Floor out) const {
+        int k = pairIndex_[in][out];
+        return (k != 0) ? &totalTimeByPair_[k - 1] : nullptr;
+    }
+
+    void userQueued() {
+        queued_ += 1;
+    }
+
+    void userWalked(Duration waited) {
+        walked_ += 1;
+        walkedAfter_.add(waited);
+        walkedAfterHistogram_.add(waited);
+    }
+
+    void userBoarded(Floor in, Floor out, Duration queued) {
+        queueTimeByFloor_[in].add(queued);
+        queueTimeByPair_[this->pairFor(in, out)].add(queued);
+    }
+
+    void userArrived(Floor in, Floor out, Duration queued, Duration rode) {
+        totalTimeByPair_[this->pairFor(in, out)].add(queued + rode);
+        queueTime_.add(queued);
+        rideTime_.add(rode);
+        totalTime_.add(queued + rode);
+        queueTimeHistogram_.add(queued);
+        rideTimeHistogram_.add(rode);
+        totalTimeHistogram_.add(queued + rode);
+    }
+
+    // Forget every sample, in place: the whole object is too big to build
+    // as a temporary on the stack in a tall building.
+    void clear() {
+        queued_ = 0;
+        walked_ = 0;
+        queueTime_ = RunningStats();
+        rideTime_ = RunningStats();
+        totalTime_ = RunningStats();
+        walkedAfter_ = RunningStats();
+        queueTimeHistogram_.clear();
+        rideTimeHistogram_.clear();
+        totalTimeHistogram_.clear();
+        walkedAfterHistogram_.clear();
+        for (int i = 0; i < numberOfFloors; ++i) {
+            queueTimeByFloor_[i].clear();
+        }
+        memset(pairIndex_, 0, sizeof pairIndex_);
+        queueTimeByPair_.clear();
+        totalTimeByPair_.clear();
+    }
+
+    void merge(const UserStatistics& rhs) {
+        queued_ += rhs.queued_;
+        walked_ += rhs.walked_;
+        queueTime_.merge(rhs.queueTime_);
+        rideTime_.merge(rhs.rideTime_);
+        totalTime_.merge(rhs.totalTime_);
+        walkedAfter_.merge(rhs.walkedAfter_);
+        queueTimeHistogram_.merge(rhs.queueTimeHistogram_);
+        rideTimeHistogram_.merge(rhs.rideTimeHistogram_);
+        totalTimeHistogram_.merge(rhs.totalTimeHistogram_);
+        walkedAfterHistogram_.merge(rhs.walkedAfterHistogram_);
+        for (int i = 0; i < numberOfFloors; ++i) {
+            queueTimeByFloor_[i].merge(rhs.queueTimeByFloor_[i]);
+            for (int j = 0; j < numberOfFloors; ++j) {
+                if (int k = rhs.pairIndex_[i][j]) {
+                    int p = this->pairFor(i, j);
+                    queueTimeByPair_[p].merge(rhs.queueTimeByPair_[k - 1]);
+                    totalTimeByPair_[p].merge(rhs.totalTimeByPair_[k - 1]);
+                }
+            }
+        }
+    }
+
+    // Save (with a SnapshotWriter) or restore (with a SnapshotReader) every
+    // sample, as ElevatorSimulation::transfer does for the whole simulation.
+    template<class Stats, class Archive>
+    static void transfer(Stats& s, Archive& ar) {
+        ar.io(s.queued_);
+        ar.io(s.walked_);
+        ar.io(s.queueTime_);
+        ar.io(s.rideTime_);
+        ar.io(s.totalTime_);
+        ar.io(s.walkedAfter_);
+        ar.io(s.queueTimeHistogram_);
+        ar.io(s.rideTimeHistogram_);
+        ar.io(s.totalTimeHistogram_);
+        ar.io(s.walkedAfterHistogram_);
+        for (int i = 0; i < numberOfFloors; ++i) {
+            ar.io(s.queueTimeByFloor_[i]);
+        }
+        ar.io(s.pairIndex_);
+        int32_t pairs = int32_t(s.queueTimeByPair_.size());
+        ar.io(pairs);
+        s.resizePairs(ar, pairs);
+        for (int32_t k = 0; k < int32_t(s.queueTimeByPair_.size()); ++k) {
+            ar.io(s.queueTimeByPair_[k]);
+            ar.io(s.totalTimeByPair_[k]);
+        }
+    }
+
+    // Print a summary table, with every line prefixed by '#' so that it
+    // can share a file with CSV or trace output. Times are in seconds.
+    void print(FILE *fp, const char *label) const {
+        double rate = (queued_ != 0) ? double(walked_) / queued_ : 0.0;
+        double rateError = (queued_ != 0) ? std::sqrt(rate * (1 - rate) / queued_) : 0.0;
+        fprintf(fp, "# %s: %lld users, %lld arrived, %lld walked away (%.2f%% +/- %.2f%%)\n",
+            label, queued_, this->arrived(), walked_, 100 * rate, 100 * rateError);
+        fprintf(fp, "#   %-12s %10s %8s %8s %8s %8s %8s %8s %8s %8s\n",
+            "seconds", "count", "mean", "sd", "min", "p50", "p90", "p95", "p99", "max");
+        auto row = [&](const char *name, const RunningStats& rs, const LogHistogram& h) {
+            if (rs.count() == 0) {
+                fprintf(fp, "#   %-12s %10d\n", name, 0);
+                return;
+            }
+            fprintf(fp, "#   %-12s %10lld %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+                name, rs.count(), rs.mean() / 10, rs.stddev() / 10, rs.min() / 10,
+                h.quantile(0.50) / 10, h.quantile(0.90) / 10, h.quantile(0.95) / 10, h.quantile(0.99) / 10,
+                rs.max() / 10);
+        };
+        row("queue", queueTime_, queueTimeHistogram_);
+        row("ride", rideTime_, rideTimeHistogram_);
+        row("total", totalTime_, totalTimeHistogram_);
+        row("walked after", walkedAfter_, walkedAfterHistogram_);
+
+        fprintf(fp, "#   %-12s %10s %8s %8s %8s\n", "queue from", "count", "p50", "p95", "p99");
+        for (int i = 0; i < numberOfFloors; ++i) {
+            const LogHistogram& h = queueTimeByFloor_[i];
+            fprintf(fp, "#   floor %-6d %10lld %8.1f %8.1f %8.1f\n",
+                i, h.count(), h.quantile(0.50) / 10, h.quantile(0.95) / 10, h.quantile(0.99) / 10);
+        }
+        if (numberOfFloors > 10) {
+            return;  // the matrix would be too wide; use dumpHistograms() instead
+        }
+        fprintf(fp, "#   %-12s", "p95 queue");
+        for (int j = 0; j < numberOfFloors; ++j) {
+            fprintf(fp, "     to %d", j);
+        }
+        fprintf(fp, "\n");
+        for (int i = 0; i < numberOfFloors; ++i) {
+            fprintf(fp, "#   from %-7d", i);
+            for (int j = 0; j < numberOfFloors; ++j) {
+                const LogHistogram *h = this->queueTimeByPair(i, j);
+                if (h == nullptr || h->count() == 0) {
+                    fprintf(fp, " %8s", "-");
+                } else {
+                    fprintf(fp, " %8.1f", h->quantile(0.95) / 10);
+                }
+            }
+            fprintf(fp, "\n");
+        }
+    }
+
+    // Dump the per-floor and per-pair histograms compactly, one per line,
+    // as "metric,origin,destination,count,buckets". The destination is "*"
+    // for the per-floor histograms; times are in tenths of a second.
+    void dumpHistograms(FILE *fp) const {
+        fprintf(fp, "metric,origin,destination,count,buckets\n");
+        auto line = [&](const char *metric, int i, int j, const LogHistogram *h) {
+            if (h == nullptr || h->count() == 0) {
+                return;
+            }
+            if (j < 0) {
+                fprintf(fp, "%s,%d,*,%lld,", metric, i, h->count());
+            } else {
+                fprintf(fp, "%s,%d,%d,%lld,", metric, i, j, h->count());
+            }
+            h->dumpBuckets(fp);
+            fprintf(fp, "\n");
+        };
+        for (int i = 0; i < numberOfFloors; ++i) {
+            line("queue", i, -1, &queueTimeByFloor_[i]);
+        }
+        for (int i = 0; i < numberOfFloors; ++i) {
+            for (int j = 0; j < numberOfFloors; ++j) {
+                line("queue", i, j, this->queueTimeByPair(i, j));
+            }
+        }
+        for (int i = 0; i < numberOfFloors; ++i) {
+            for (int j = 0; j < numberOfFloors; ++j) {
+                line("total", i, j, this->totalTimeByPair(i, j));
+            }
+        }
+    }
+
+private:
+    // Make room for n pairs read from a snapshot, first checking that n is
+    // possible and that every index refers to one of them.
+    void resizePairs(SnapshotReader& r, int32_t n) {
+        bool ok = (0 <= n && n <= numberOfFloors * numberOfFloors);
+        for (int i = 0; i < numberOfFloors; ++i) {
+            for (int j = 0; j < numberOfFloors; ++j) {
+                ok = ok && (0 <= pairIndex_[i][j] && pairIndex_[i][j] <= n);
+            }
+        }
+        if (!ok) {
+            r.fail();
+            memset(pairIndex_, 0, sizeof pairIndex_);
+            n = 0;
+        }
+        queueTimeByPair_.resize(n);
+        totalTimeByPair_.resize(n);
+    }
+    void resizePairs(SnapshotWriter&, int32_t) const {}
+};
+
+// Time-weighted averages of the simulation's state. The state changes only
+// while an event is being processed, so adding up (state * time since the
+// previous event) just before each event gives the exact time integrals,
+// at constant cost per event. The queues, one per floor, are instead
+// integrated only when one of them changes (and by finish(), at the end
+// of runUntil), so that a tall building costs no more per event.
+struct OccupancyStatistics {
+    Time start_ = 0;
+    Time last_ = 0;
+    long long queueLength_[numberOfFloors] = {};     // integral of queue_[f].size() up to queueSince_[f]
+    Time queueSince_[numberOfFloors] = {};
+    long long carLoad_ = 0;             // integral of elevator_.size()
+    long long doorsBusy_ = 0;           // time with D1 set
+    long long recentlyActive_ = 0;      // time with D2 set
+    long long doorsIdle_ = 0;           // time with D3 set
+    long long elevatorStep_[10] = {};   // time spent waiting to perform step E1 through E9
+
+    Time elapsed() const { return last_ - start_; }
+    double average(long long integral) const { return elapsed() ? double(integral) / elapsed() : 0.0; }
+
+    void startAt(Time now) {
+        start_ = last_ = now;
+        std::fill(queueSince_, queueSince_ + numberOfFloors, now);
+    }
+
+    void advance(Time now, const ElevatorSimulation& sim);
+
+    // Call at the time of the latest advance(), just before queue_[f],
+    // currently of the given length, changes.
+    void queueChanging(Floor f, size_t length) {
+        queueLength_[f] += (last_ - queueSince_[f]) * (long long)length;
+        queueSince_[f] = last_;
+    }
+
+    void finish(const ElevatorSimulation& sim);
+
+    void print(FILE *fp) const {
+        fprintf(fp, "# time-weighted averages over %.1f seconds:\n", elapsed() / 10.0);
+        fprintf(fp, "#   queue length on floors 0-%d:", numberOfFloors - 1);
+        for (int i = 0; i < numberOfFloors; ++i) {
+            fprintf(fp, " %.3f", average(queueLength_[i]));
+        }
+        fprintf(fp, "\n#   car load %.3f; doors busy (D1) %.1f%%, active (D2) %.1f%%, idle open (D3) %.1f%%\n",
+            average(carLoad_), 100 * average(doorsBusy_), 100 * average(recentlyActive_), 100 * average(doorsIdle_));
+        fprintf(fp, "#   elevator waiting to perform:");
+        for (int i = 1; i < 10; ++i) {
+            if (i != 5 && i != 9) {  // E5 and E9 are separate tasks
+                fprintf(fp, " E%d %.1f%%", i, 100 * average(elevatorStep_[i]));
+            }
+        }
+        fprintf(fp, "\n");
+    }
+};
+
+// Memory held by the simulation. Every UserTask, and every block of the
+// wait_, queue_[] and elevator_ deques, is allocated through a counting
+// allocator, so the accounts know both the current and the peak footprint.
+struct MemoryStatistics {
+    MemoryAccount users_;     // UserTasks, with their shared_ptr control blocks
+    MemoryAccount wait_;
+    MemoryAccount queues_;    // all the queue_[] deques together
+    MemoryAccount elevator_;
+    long long allocations_ = 0;  // allocations of any kind made during runUntil
+    long long events_ = 0;       // events processed during runUntil
+
+    void print(FILE *fp) const {
+        fprintf(fp, "# memory: %lld live users (peak %lld), %.0f bytes per user\n",
+            users_.blocks_, users_.peakBlocks_, users_.peakBlocks_ ? double(users_.peakBytes_) / users_.peakBlocks_ : 0.0);
+        users_.print(fp, "users");
+        wait_.print(fp, "wait_");
+        queues_.print(fp, "queue_[]");
+        elevator_.print(fp, "elevator_");
+        if (COUNT_ALLOCATIONS) {
+            fprintf(fp, "#   %lld allocations in %lld events (%.3f per event)\n",
+                allocations_, events_, events_ ? double(allocations_) / events_ : 0.0);
+        } else {
+            fprintf(fp, "#   allocations not counted in %lld events (build with -DCOUNT_ALLOCATIONS)\n", events_);
+        }
+    }
+};
+
+static const char snapshotMagic[8] = { 'K', 'E', 'S', 'N', 'A', 'P', 'S', '3' };
+
+struct ElevatorSimulation {
+public:
+    Duration durationBeforeRapidDoorClose = 25;
+    Duration durationBeforeInactivity = 300;
+    Duration durationBeforeDoorClose = 76;
+    Duration durationOfDoorOpen = 20;
+    Duration durationOfLeaving = 25;
+    Duration durationOfEntering = 25;
+    Duration delayAfterDoorFlutter = 40;
+    Duration durationOfDoorClose = 20;
+    Duration durationOfUpwardAcceleration = 15;
+    Duration durationOfDownwardAcceleration = 15;
+    Duration durationOfDoorOpenFromDecisionSubroutine = 20;
+    Duration delayBeforeHoming = 20;
+    Duration durationOfUpwardTravel = 51;
+    Duration durationOfUpwardDeceleration = 14;
+    Duration durationOfDownwardTravel = 61;
+    Duration durationOfDownwardDeceleration = 23;
+
+    // Each new user waits between minGiveupTime and maxGiveupTime before
+    // walking away, and the next user arrives between minInterarrivalTime
+    // and maxInterarrivalTime later.
+    Duration minGiveupTime = 300;
+    Duration maxGiveupTime = 1200;
+    Duration minInterarrivalTime = 10;
+    Duration maxInterarrivalTime = 900;
+
+    bool trace_ = true;  // Print each event as it is processed?
+    TraceComparator *compare_ = nullptr;  // Non-null to check the trace instead of printing it.
+    bool useKnuthData_ = USE_KNUTH_DATA;  // Do the first 11 users come from Knuth's Table 1?
+    std::unique_ptr<EventProfile> profile_;  // Non-null to profile the event loop.
+    ArrivalSource *arrivals_ = nullptr;  // Non-null to replay recorded arrivals instead of random ones.
+    const TrafficProfile *traffic_ = nullptr;  // Non-null for time-of-day arrival rates and floor mixes.
+    TrafficState trafficState_;
+    UserRecordSink *userRecords_ = nullptr;  // Non-null to write a record for each user who arrives or walks.
+
+    // Under common random numbers, each random quantity drawn for the n'th
+    // arriving user comes from its own generator, determined only by the
+    // seed, the purpose of the draw, and n. Two simulations with the same
+    // seed therefore see exactly the same arrivals, no matter how differently
+    // their elevators behave, which makes paired comparisons much sharper.
+    bool commonRandomNumbers_ = false;
+
+    // An antithetic simulation complements every uniform draw in createNewUser,
+    // so that a user who would have arrived late, patient, and bound for the
+    // top floor in the plain run arrives early, impatient, and bound for the
+    // bottom floor instead. Averaging the two runs cancels much of the noise.
+    bool antithetic_ = false;
+
+    // Is this run either member of an antithetic pair? Both members must
+    // then draw every quantity by inverting one uniform, so that they stay
+    // mirror images of each other and consume their generators in step.
+    bool antitheticPair_ = false;
+
+    // Draw bounded integers as rand_() % n, as this simulator originally did,
+    // instead of with xoshiro256ss::bounded? Modulo is slightly biased and
+    // costs a division, but reproduces traces and results from before.
+    bool moduloBounded_ = false;
+
+    enum RandomPurpose { InFloor, OutFloor, GiveupTime, InterarrivalTime, NumberOfRandomPurposes };
+
+public:
+    struct NewUserInfo {
+        Floor in_;             // floor on which this user enters
+        Floor out_;            // this user's destination floor
+        Duration giveuptime_;  // amount of time this user will wait
+        Duration intertime_;   // amount of time before next user arrives
+    };
+
+    static constexpr Duration noMoreUsers = -1;  // as intertime_, for the last recorded user
+
+    xoshiro256ss rand_;
+    xoshiro256ss::u64 streamKeys_[NumberOfRandomPurposes];
+    xoshiro256ss userStreams_[NumberOfRandomPurposes];
+    long long arrivalsDrawn_ = 0;
+    long long eventsProcessed_ = 0;
+    Time now_ = 0;  // the deadline of the latest runUntil
+    int usersCreated_ = 0;
+    int knuthDataIndex_ = 0;
+
+    // Random users are drawn userBlockSize at a time, ahead of their arrival.
+    // Parameters of the arrival process changed in mid-run therefore take
+    // effect only from the next block, unless discardUserBlock() is called.
+    // Under time-of-day traffic, userBlockTraffic_[i] is the traffic state
+    // from just before user i was drawn, so that a block can be discarded.
+    static constexpr int userBlockSize = 64;
+    NewUserInfo userBlock_[userBlockSize];
+    TrafficState userBlockTraffic_[userBlockSize];
+    int userBlockNext_ = userBlockSize;
+
+    UserStatistics stats_;
+    OccupancyStatistics occupancy_;
+    MemoryStatistics memory_;
+
+#if PRINT_STATISTICS
+    // Every floor at which the elevator has stopped with passengers aboard.
+    // A passenger's stops are exactly the entries logged between boarding
+    // and getting out, so each passenger needs only the index at which to
+    // start. Entry i of the log is stopLog_[i - stopLogBase_]; whenever
+    // the car empties, nobody needs the log any more and it is cleared.
+    std::deque<Floor> stopLog_;
+    long long stopLogBase_ = 0;
+
+    long long stopLogEnd() const { return stopLogBase_ + (long long)stopLog_.size(); }
+#endif
+
+    Floor floor_ = homeFloor;
+    bool d1_ = false;  // Are the doors open AND people are getting in or out?
+    bool d2_ = false;  // Has the elevator been active within the last 30 seconds?
+    bool d3_ = false;  // Are the doors open BUT nobody is getting in or out?
+    Direction state_ = Neutral;
+
+    bool callup_[numberOfFloors] = {};
+    bool calldown_[numberOfFloors] = {};
+    bool callcar_[numberOfFloors] = {};
+
+    template<class T> using CountedDeque = std::deque<T, CountingAllocator<T>>;
+    CountedDeque<std::shared_ptr<Task>> wait_ { CountingAllocator<std::shared_ptr<Task>>(&memory_.wait_) };
+    CountedDeque<std::shared_ptr<UserTask>> queue_[numberOfFloors];  // counted by the constructor
+    CountedDeque<std::shared_ptr<UserTask>> elevator_ { CountingAllocator<std::shared_ptr<UserTask>>(&memory_.elevator_) };
+
+    std::shared_ptr<ElevatorTask> elevatortask_ = std::make_shared<ElevatorTask>();
+    std::shared_ptr<E5Task> e5task_ = std::make_shared<E5Task>();
+    std::shared_ptr<E9Task> e9task_ = std::make_shared<E9Task>();
+
+public:
+    explicit ElevatorSimulation(xoshiro256ss::u64 seed = 0) {
+        this->reseed(seed);
+        for (auto& q : queue_) {
+            q = CountedDeque<std::shared_ptr<UserTask>>(CountingAllocator<std::shared_ptr<UserTask>>(&memory_.queues_));
+        }
+        auto t = this->makeUser();
+        Time time_zero = 0;
+        this->schedule(t, 1, time_zero);  // The first user enters at time zero.
+    }
+
+    void runUntil(Time deadline) {
+        long long allocationsBefore = allocationCounts().allocations_;
+        long long eventsBefore = eventsProcessed_;
+        if (profile_ != nullptr) {
+            auto start = std::chrono::steady_clock::now();
+            this->runEvents<true>(deadline);
+            profile_->seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } else {
+            this->runEvents<false>(deadline);
+        }
+        occupancy_.finish(*this);
+        memory_.allocations_ += allocationCounts().allocations_ - allocationsBefore;
+        memory_.events_ += eventsProcessed_ - eventsBefore;
+        now_ = deadline;
+    }
+
+    // Start drawing random numbers afresh from the given seed, as if the
+    // simulation had been constructed with it. Users drawn ahead of their
+    // arrival are thrown away, so every later user comes from the new seed
+    // (and from whatever parameters are set before the next one arrives).
+    void reseed(xoshiro256ss::u64 seed) {
+        rand_ = xoshiro256ss(seed);
+        xoshiro256ss::u64 x = ~seed;
+        for (auto& key : streamKeys_) {
+            key = xoshiro256ss::splitmix64(x);
+        }
+        this->discardUserBlock();
+    }
+
+    // Forget the users drawn but not yet arrived, rewinding the count of
+    // users drawn and the time-of-day traffic to the last user consumed.
+    void discardUserBlock() {
+        if (userBlockNext_ == userBlockSize) {
+            return;
+        }
+        if (traffic_ != nullptr) {
+            trafficState_ = userBlockTraffic_[userBlockNext_];
+        }
+        arrivalsDrawn_ -= userBlockSize - userBlockNext_;
+        userBlockNext_ = userBlockSize;
+    }
+
+    // Forget the statistics gathered so far, as at the end of a warm-up;
+    // the time-weighted averages start again from now_.
+    void resetStatistics() {
+        stats_.clear();
+        occupancy_ = OccupancyStatistics();
+        occupancy_.startAt(now_);
+    }
+
+    template<bool Profile>
+    void runEvents(Time deadline) {
+        while (true) {
+            if (wait_.empty()) {
+                // The recorded arrivals have run out, and the elevator is idle.
+                occupancy_.advance(deadline, *this);
+                return;
+            }
+            std::shared_ptr<Task> t = wait_.front();
+            if (t->nexttime_ >= deadline) {
+                occupancy_.advance(deadline, *this);
+                return;
+            }
+            if (Profile) {
+                profile_->pendingEvents_.add(wait_.size());
+            }
+            wait_.pop_front();
+            eventsProcessed_ += 1;
+            occupancy_.advance(t->nexttime_, *this);
+            if (trace_) {
+                char line[100];
+                snprintf(line, sizeof line, "%04lld %c %d %c %c %c %s",
+                    t->nexttime_, (state_ == Neutral ? 'N' : state_ == GoingUp ? 'U' : 'D'),
+                    floor_, "0X"[int(d1_)], "0X"[int(d2_)], "0X"[int(d3_)], t->stateStr().c_str());
+                if (compare_ == nullptr) {
+                    puts(line);
+                } else if (!compare_->matches(line)) {
+                    return;
+                }
+            }
+#if 0
+            for (int i=0; i < numberOfFloors; ++i) {
+                if (!queue_[i].empty()) printf("Queued on floor %d: %zu users\n", i, queue_[i].size());
+            }
+            if (!elevator_.empty()) printf("In the elevator: %zu users\n", elevator_.size());
+            printf("Tasks in the wait queue: ");
+            for (const auto& tt : wait_) {
+                printf("%s/%lld ", tt->stateStr().c_str(), tt->nexttime_);
+            }
+            printf("\n");
+#endif
+
+            if (Profile) {
+                bool isUser = t->isUser();
+                int step = std::min(t->nextinst_, EventProfile::maxStep - 1);
+                PerfCounterValues perfBefore;
+                if (profile_->perf_ != nullptr) {
+                    perfBefore = profile_->perf_->read();
+                }
+                unsigned long long before = readCycleCounter();
+                t->resume(*this);
+                profile_->cycles_[isUser][step] += readCycleCounter() - before;
+                profile_->events_[isUser][step] += 1;
+                if (profile_->perf_ != nullptr) {
+                    profile_->perfByStep_[isUser][step] += profile_->perf_->read() - perfBefore;
+                }
+            } else {
+                t->resume(*this);
+            }
+        }
+    }
+
+    NewUserInfo createNewUser() {
+        static const NewUserInfo knuthData[] = {
+            { 0, 2, 152-0,     38 -    0 },
+            { 4, 1, 36000,    136 -   38 },
+            { 2, 1, 36000,    141 -  136 },
+            { 2, 1, 36000,    291 -  141 },
+            { 3, 1, 36000,    364 -  291 },
+            { 2, 1, 540-364,  602 -  364 },
+            { 1, 2, 36000,    827 -  602 },
+            { 1, 0, 36000,    876 -  827 },
+            { 1, 3, 36000,   1048 -  876 },
+            { 0, 4, 36000,   4384 - 1048 },
+            { 2, 3, 36000,   4845 - 4384 },  // Knuth's "User 17"
+        };
+        if (arrivals_ != nullptr) return this->nextRecordedUser();
+        if (useKnuthData_ && knuthDataIndex_ < 11) return knuthData[knuthDataIndex_++];
+        if (userBlockNext_ == userBlockSize) {
+            this->refillUserBlock();
+        }
+        return userBlock_[userBlockNext_++];
+    }
+
+    // Draw the next userBlockSize random users at once. In the usual case,
+    // the raw outputs of rand_ come first, in one tight loop, and are then
+    // turned into users; the users and the order in which they consume
+    // rand_ are exactly as if each had been drawn when it arrived. Under
+    // common random numbers or time-of-day traffic, each user comes from
+    // its own streams or depends on the previous arrival time, so they are
+    // drawn one after another by drawRandomUser.
+    void refillUserBlock() {
+        userBlockNext_ = 0;
+        if (commonRandomNumbers_ || traffic_ != nullptr) {
+            for (int i = 0; i < userBlockSize; ++i) {
+                userBlockTraffic_[i] = trafficState_;
+                userBlock_[i] = this->drawRandomUser();
+            }
+            return;
+        }
+        xoshiro256ss::u64 raw[4 * userBlockSize];
+        for (auto& x : raw) {
+            x = rand_();
+        }
+        // Bounded draws take the raw outputs in order; a rejected draw (rare)
+        // takes one more, and past the end of the block they come from rand_.
+        struct PregeneratedDraws {
+            const xoshiro256ss::u64 *next_;
+            const xoshiro256ss::u64 *end_;
+            xoshiro256ss& rand_;
+            xoshiro256ss::u64 operator()() { return (next_ != end_) ? *next_++ : rand_(); }
+        } draws { raw, raw + 4 * userBlockSize, rand_ };
+        auto random_between = [&](Duration lo, Duration hi) {
+            xoshiro256ss::u64 range = 1 + hi - lo;
+            Duration k = Duration(moduloBounded_ ? draws() % range : xoshiro256ss::boundedFrom(range, draws));
+            return antithetic_ ? (hi - k) : (lo + k);
+        };
+        for (auto& user : userBlock_) {
+            user.in_ = random_between(0, numberOfFloors - 1);
+            user.out_ = (user.in_ + random_between(1, numberOfFloors - 1)) % numberOfFloors;
+            user.giveuptime_ = random_between(minGiveupTime, maxGiveupTime);
+            user.intertime_ = random_between(minInterarrivalTime, maxInterarrivalTime);
+        }
+        arrivalsDrawn_ += userBlockSize;
+    }
+
+    NewUserInfo drawRandomUser() {
+        long long n = arrivalsDrawn_++;
+        auto random_between = [&](RandomPurpose purpose, Duration lo, Duration hi) {
+            xoshiro256ss& g = this->generatorFor(purpose, n);
+            xoshiro256ss::u64 range = 1 + hi - lo;
+            Duration k = Duration(moduloBounded_ ? g() % range : g.bounded(range));
+            return antithetic_ ? (hi - k) : (lo + k);
+        };
+        if (traffic_ != nullptr) {
+            // A uniform in [0, 1) with 53 bits of precision.
+            auto uniform = [&](RandomPurpose purpose) {
+                xoshiro256ss::u64 k = this->generatorFor(purpose, n)() >> 11;
+                return double(antithetic_ ? (1uLL << 53) - 1 - k : k) * (1.0 / 9007199254740992.0);
+            };
+            int period = trafficState_.period_;
+            Floor in, out;
+            traffic_->pickFloors(period, uniform(InFloor), uniform(OutFloor), in, out);
+            Duration giveup = random_between(GiveupTime, minGiveupTime, maxGiveupTime);
+            Time before = roundToTicks(trafficState_.clock_);
+            // The ziggurat avoids a log() per arrival, but it takes a varying
+            // number of outputs, so both runs of an antithetic pair invert
+            // one uniform instead.
+            double e = (antithetic_ || antitheticPair_) ? -std::log1p(-uniform(InterarrivalTime))
+                                                        : exponentialVariate(this->generatorFor(InterarrivalTime, n));
+            traffic_->advance(trafficState_, e);
+            Duration intertime = roundToTicks(trafficState_.clock_) - before;
+            return NewUserInfo{ in, out, giveup, intertime };
+        }
+        Floor in = random_between(InFloor, 0, numberOfFloors - 1);
+        Floor out = (in + random_between(OutFloor, 1, numberOfFloors - 1)) % numberOfFloors;
+        Duration giveup = random_between(GiveupTime, minGiveupTime, maxGiveupTime);
+        Duration intertime = random_between(InterarrivalTime, minInterarrivalTime, maxInterarrivalTime);
+        return NewUserInfo{ in, out, giveup, intertime };
+    }
+
+    // Replay the arrivals from src, starting with the first user, who has
+    // been scheduled at time zero but not yet run.
+    void replayArrivals(ArrivalSource *src) {
+        assert(eventsProcessed_ == 0 && wait_.size() == 1);
+        arrivals_ = src;
+        const ArrivalRecord *first = src->peek();
+        if (first == nullptr) {
+            this->checkArrivalsFailed();
+            this->cancel(wait_.front());
+        } else {
+            this->checkArrival(*first, 0);
+            this->schedule(wait_.front(), 1, Time(first->time_));
+        }
+    }
+
+    NewUserInfo nextRecordedUser() {
+        const ArrivalRecord *r = arrivals_->peek();
+        assert(r != nullptr);  // each user's U1 runs only if its record exists
+        NewUserInfo info { r->in_, r->out_, r->giveup_, noMoreUsers };
+        Time when = Time(r->time_);
+        arrivals_->pop();
+        if (const ArrivalRecord *next = arrivals_->peek()) {
+            this->checkArrival(*next, when);
+            info.intertime_ = Duration(next->time_ - when);
+        } else {
+            this->checkArrivalsFailed();
+        }
+        return info;
+    }
+
+    // A bad record ends the run, rather than the replay carrying on without it.
+    void checkArrivalsFailed() {
+        if (arrivals_->failed()) {
+            exit(1);
+        }
+    }
+
+    void checkArrival(const ArrivalRecord& r, Time previous) {
+        const char *problem = nullptr;
+        if (r.time_ < previous) {
+            problem = "arrivals are out of order";
+        } else if (r.in_ < 0 || r.in_ >= numberOfFloors || r.out_ < 0 || r.out_ >= numberOfFloors || r.in_ == r.out_) {
+            problem = "bad floor numbers";
+        } else if (r.giveup_ < 0) {
+            problem = "negative give-up time";
+        }
+        if (problem != nullptr) {
+            fprintf(stderr, "Recorded arrival at time %lld (floors %d to %d, give-up %d): %s\n",
+                (long long)r.time_, r.in_, r.out_, int(r.giveup_), problem);
+            exit(1);
+        }
+    }
+
+    xoshiro256ss& generatorFor(RandomPurpose purpose, long long n) {
+        if (!commonRandomNumbers_) {
+            return rand_;
+        }
+        // The constructor xoshiro256ss(seed) hashes seed+k*0x9e37... for k=1..4;
+        // spacing the per-user seeds four steps apart keeps those inputs
+        // disjoint between users.
+        xoshiro256ss::u64 seed = streamKeys_[purpose] + xoshiro256ss::u64(n) * 4 * 0x9e3779b97f4a7c15uLL;
+        userStreams_[purpose] = xoshiro256ss(seed);
+        return userStreams_[purpose];
+    }
+
+    std::shared_ptr<UserTask> makeUser() {
+        usersCreated_ += 1;
+        return std::allocate_shared<UserTask>(CountingAllocator<UserTask>(&memory_.users_), usersCreated_);
+    }
+
+    void schedule(std::shared_ptr<Task> t, int step, Time when) {
+        t->nextinst_ = step;
+        t->nexttime_ = when;
+        std_erase(wait_, t);
+        wait_.push_back(t);
+        std::stable_sort(wait_.begin(), wait_.end(), Task::ByNextTime());
+    }
+
+    void schedule_immediately(std::shared_ptr<Task> t, int step, Time when) {
+        t->nextinst_ = step;
+        t->nexttime_ = when;
+        std_erase(wait_, t);
+        wait_.push_front(t);
+        assert(std::is_sorted(wait_.begin(), wait_.end(), Task::ByNextTime()));
+    }
+
+    void cancel(std::shared_ptr<Task> t) {
+        std_erase(wait_, t);
+    }
+
+    // Checkpoints. A snapshot holds everything needed to carry on exactly
+    // where the simulation stopped: the parameters, the random number
+    // generators (and any users already drawn from them), the registers
+    // and call buttons, every task's next step and time, the order of wait_
+    // and of each queue, every live user, and the statistics so far. It
+    // does not hold the time-of-day traffic profile, which must be attached
+    // again, nor the memory accounts, which describe the restored copy.
+    // Recorded arrivals can't be checkpointed.
+
+    // Returns false, having printed why, if this simulation can't be saved.
+    bool save(SnapshotWriter& w) const {
+        if (arrivals_ != nullptr) {
+            fprintf(stderr, "A simulation replaying recorded arrivals can't be checkpointed\n");
+            return false;
+        }
+        ElevatorSimulation::transfer(*this, w);
+        // Users are numbered by their first appearance in wait_, queue_[]
+        // and elevator_ (there are no others), and every entry of those
+        // deques is saved as a reference: -1, -2, -3 for the elevator's
+        // tasks, or the number of a user.
+        std::vector<const UserTask*> users;
+        std::unordered_map<const Task*, int32_t> numbers;
+        auto ref = [&](const Task *t) -> int32_t {
+            if (t == elevatortask_.get()) return -1;
+            if (t == e5task_.get()) return -2;
+            if (t == e9task_.get()) return -3;
+            return numbers.at(t);
+        };
+        auto collect = [&](const Task *t) {
+            if (t->isUser() && numbers.emplace(t, int32_t(users.size())).second) {
+                users.push_back(static_cast<const UserTask*>(t));
+            }
+        };
+        for (const auto& t : wait_) collect(t.get());
+        for (const auto& q : queue_) for (const auto& u : q) collect(u.get());
+        for (const auto& u : elevator_) collect(u.get());
+        w.io(int32_t(users.size()));
+        for (const UserTask *u : users) {
+            w.io(u->userNumber_);
+            w.io(u->nextinst_);
+            w.io(u->nexttime_);
+            w.io(u->in_);
+            w.io(u->out_);
+            w.io(u->enteredQueueAt_);
+            w.io(u->enteredCarAt_);
+            w.io(u->maxOccupancy_);
+#if PRINT_STATISTICS
+            w.io(u->firstStop_);
+#endif
+        }
+        auto refs = [&](const auto& deque) {
+            w.io(int64_t(deque.size()));
+            for (const auto& t : deque) {
+                w.io(ref(t.get()));
+            }
+        };
+        refs(wait_);
+        for (const auto& q : queue_) {
+            refs(q);
+        }
+        refs(elevator_);
+        return true;
+    }
+
+    // Replace this simulation's state with a snapshot's. Returns false,
+    // having printed why, if the snapshot is truncated or was made by a
+    // different build (or with a different traffic profile); the simulation
+    // must then be discarded.
+    bool restore(SnapshotReader& r) {
+        wait_.clear();
+        for (auto& q : queue_) {
+            q.clear();
+        }
+        elevator_.clear();
+        ElevatorSimulation::transfer(*this, r);
+        if (!r.ok()) {
+            fprintf(stderr, "Not a snapshot from this build of the simulator, or truncated\n");
+            return false;
+        }
+        if (!trafficMatches_) {
+            fprintf(stderr, "The snapshot was made with %s time-of-day traffic profile\n",
+                (traffic_ == nullptr) ? "a" : "a different");
+            return false;
+        }
+        int32_t n = 0;
+        r.io(n);
+        std::vector<std::shared_ptr<UserTask>> users;
+        for (int32_t i = 0; i < n && r.ok(); ++i) {
+            int userNumber = 0;
+            r.io(userNumber);
+            auto u = std::allocate_shared<UserTask>(CountingAllocator<UserTask>(&memory_.users_), userNumber);
+            r.io(u->nextinst_);
+            r.io(u->nexttime_);
+            r.io(u->in_);
+            r.io(u->out_);
+            r.io(u->enteredQueueAt_);
+            r.io(u->enteredCarAt_);
+            r.io(u->maxOccupancy_);
+#if PRINT_STATISTICS
+            r.io(u->firstStop_);
+#endif
+            users.push_back(std::move(u));
+        }
+        auto task = [&](int32_t ref) -> std::shared_ptr<Task> {
+            switch (ref) {
+                case -1: return elevatortask_;
+                case -2: return e5task_;
+                case -3: return e9task_;
+            }
+            if (ref < 0 || ref >= int32_t(users.size())) {
+                r.fail();
+                return nullptr;
+            }
+            return users[ref];
+        };
+        auto refs = [&](auto& deque, auto cast) {
+            int64_t size = 0;
+            r.io(size);
+            for (int64_t i = 0; i < size && r.ok(); ++i) {
+                int32_t ref = 0;
+                r.io(ref);
+                if (auto t = task(ref)) {
+                    deque.push_back(cast(t));
+                }
+            }
+        };
+        auto asTask = [](std::shared_ptr<Task> t) { return t; };
+        auto asUser = [&](std::shared_ptr<Task> t) {
+            if (!t->isUser()) {
+                r.fail();
+            }
+            return std::static_pointer_cast<UserTask>(t);
+        };
+        refs(wait_, asTask);
+        for (auto& q : queue_) {
+            refs(q, asUser);
+        }
+        refs(elevator_, asUser);
+        if (!r.ok() || !r.atEnd()) {
+            fprintf(stderr, "The snapshot is truncated or corrupt\n");
+            return false;
+        }
+        return true;
+    }
+
+    // A copy of this simulation, made by saving and restoring a snapshot,
+    // with the same traffic profile attached and the trace turned off.
+    // Returns nullptr if this simulation can't be saved.
+    std::unique_ptr<ElevatorSimulation> fork() const {
+        SnapshotWriter w;
+        if (!this->save(w)) {
+            return nullptr;
+        }
+        auto copy = std::make_unique<ElevatorSimulation>();
+        copy->trace_ = false;
+        copy->traffic_ = traffic_;
+        SnapshotReader r(w.bytes().data(), w.bytes().size());
+        if (!copy->restore(r)) {
+            return nullptr;
+        }
+        return copy;
+    }
+
+    bool saveCheckpoint(const char *path) const {
+        SnapshotWriter w;
+        return this->save(w) && w.writeFile(path);
+    }
+
+    bool restoreCheckpoint(const char *path) {
+        std::vector<char> bytes;
+        if (!SnapshotReader::readFile(path, bytes)) {
+            return false;
+        }
+        SnapshotReader r(bytes.data(), bytes.size());
+        if (!this->restore(r)) {
+            fprintf(stderr, "%s: can't restore this checkpoint\n", path);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool trafficMatches_ = true;  // set by transfer() when restoring
+
+    // Save (with a SnapshotWriter) or restore (with a SnapshotReader) every
+    // field of the simulation apart from its tasks and users.
+    template<class Sim, class Archive>
+    static void transfer(Sim& sim, Archive& ar) {
+        char magic[8];
+        memcpy(magic, snapshotMagic, 8);
+        ar.io(magic);
+        int32_t build[4] = { numberOfFloors, homeFloor, int32_t(sizeof(Time)), PRINT_STATISTICS };
+        int32_t expected[4];
+        memcpy(expected, build, sizeof build);
+        ar.io(build);
+        if (memcmp(magic, snapshotMagic, 8) != 0 || memcmp(build, expected, sizeof build) != 0) {
+            sim.fail(ar);
+            return;
+        }
+
+        ar.io(sim.durationBeforeRapidDoorClose);
+        ar.io(sim.durationBeforeInactivity);
+        ar.io(sim.durationBeforeDoorClose);
+        ar.io(sim.durationOfDoorOpen);
+        ar.io(sim.durationOfLeaving);
+        ar.io(sim.durationOfEntering);
+        ar.io(sim.delayAfterDoorFlutter);
+        ar.io(sim.durationOfDoorClose);
+        ar.io(sim.durationOfUpwardAcceleration);
+        ar.io(sim.durationOfDownwardAcceleration);
+        ar.io(sim.durationOfDoorOpenFromDecisionSubroutine);
+        ar.io(sim.delayBeforeHoming);
+        ar.io(sim.durationOfUpwardTravel);
+        ar.io(sim.durationOfUpwardDeceleration);
+        ar.io(sim.durationOfDownwardTravel);
+        ar.io(sim.durationOfDownwardDeceleration);
+        ar.io(sim.minGiveupTime);
+        ar.io(sim.maxGiveupTime);
+        ar.io(sim.minInterarrivalTime);
+        ar.io(sim.maxInterarrivalTime);
+
+        ar.io(sim.useKnuthData_);
+        ar.io(sim.knuthDataIndex_);
+        ar.io(sim.commonRandomNumbers_);
+        ar.io(sim.antithetic_);
+        ar.io(sim.antitheticPair_);
+        ar.io(sim.moduloBounded_);
+        ar.io(sim.rand_);
+        ar.io(sim.streamKeys_);
+        ar.io(sim.arrivalsDrawn_);
+        ar.io(sim.usersCreated_);
+        ar.io(sim.userBlock_);
+        ar.io(sim.userBlockTraffic_);
+        ar.io(sim.userBlockNext_);
+        ar.io(sim.eventsProcessed_);
+        ar.io(sim.now_);
+
+        int32_t periods = (sim.traffic_ != nullptr) ? int32_t(sim.traffic_->periods().size()) : 0;
+        int32_t savedPeriods = periods;
+        ar.io(savedPeriods);
+        sim.checkTraffic(savedPeriods == periods);
+        ar.io(sim.trafficState_);
+
+        ar.io(sim.floor_);
+        ar.io(sim.d1_);
+        ar.io(sim.d2_);
+        ar.io(sim.d3_);
+        ar.io(sim.state_);
+        ar.io(sim.callup_);
+        ar.io(sim.calldown_);
+        ar.io(sim.callcar_);
+        for (Task *t : { static_cast<Task*>(sim.elevatortask_.get()), static_cast<Task*>(sim.e5task_.get()), static_cast<Task*>(sim.e9task_.get()) }) {
+            ar.io(t->nextinst_);
+            ar.io(t->nexttime_);
+        }
+
+        UserStatistics::transfer(sim.stats_, ar);
+        ar.io(sim.occupancy_);
+
+#if PRINT_STATISTICS
+        ar.io(sim.stopLogBase_);
+        int64_t stops = sim.stopLog_.size();
+        ar.io(stops);
+        sim.resizeStopLog(stops);
+        for (int64_t i = 0; i < stops && i < int64_t(sim.stopLog_.size()); ++i) {
+            ar.io(sim.stopLog_[i]);
+        }
+#endif
+    }
+
+    void fail(SnapshotReader& r) { r.fail(); }
+    void fail(SnapshotWriter&) const {}
+    void checkTraffic(bool matches) { trafficMatches_ = matches; }
+    void checkTraffic(bool) const {}
+#if PRINT_STATISTICS
+    void resizeStopLog(int64_t n) { stopLog_.resize(size_t(std::max<int64_t>(0, std::min<int64_t>(n, 1 << 24)))); }
+    void resizeStopLog(int64_t) const {}
+#endif
+
+public:
+
+    void decision(Time now, bool fromE6) {
+        // D1. Decision necessary?
+        if (state_ != Neutral) {
+            return;
+        }
+        // D2. Should doors open?
+        if (elevatortask_->nextinst_ == 1 && (callup_[homeFloor] || calldown_[homeFloor] || callcar_[homeFloor])) {
+            this->schedule(elevatortask_, 3, now + durationOfDoorOpenFromDecisionSubroutine);
+            return;
+        }
+        // D3. Any calls?
+        int jj = (fromE6 ? homeFloor : -1);
+        for (int j=0; j < numberOfFloors; ++j) {
+            if (j == floor_) {
+                continue;
+            }
+            if (callup_[j] || calldown_[j] || callcar_[j]) {
+                jj = j;
+                break;
+            }
+        }
+        if (jj != -1) {
+            // D4. Set STATE.
+            state_ = (jj < floor_) ? GoingDown : (jj > floor_) ? GoingUp : Neutral;
+            // D5. Elevator dormant?
+            if (elevatortask_->nextinst_ == 1 && jj != homeFloor) {
+                this->schedule(elevatortask_, 6, now + delayBeforeHoming);
+            }
+        }
+    }
+};
+
+
+    inline void UserTask::resume(ElevatorSimulation& sim) {
+        Time now = this->nexttime_;
+        std::shared_ptr<UserTask> me = shared_user_from_this();
+#if EXERCISE_SIX
+        auto elevator_is_available = [&](Floor in, Floor out) {
+            Direction avoid = (out < in) ? GoingUp : GoingDown;
+            return (sim.floor_ == in) && (sim.state_ != avoid);
+        };
+#else
+        auto elevator_is_available = [&](Floor in, Floor) {
+            return (sim.floor_ == in);
+        };
+#endif
+        switch (this->nextinst_) {
+            case 1: {
+                // U1. Enter, prepare for successor.
+                auto info = sim.createNewUser();
+                if (info.intertime_ != ElevatorSimulation::noMoreUsers) {
+                    sim.schedule(sim.makeUser(), 1, now + info.intertime_);
+                }
+                // U2. Signal and wait.
+                assert(info.in_ != info.out_);
+                if (elevator_is_available(info.in_, info.out_) && sim.elevatortask_->nextinst_ == 6) {
+                    sim.schedule_immediately(sim.elevatortask_, 3, now);
+                } else if (elevator_is_available(info.in_, info.out_) && sim.d3_) {
+                    sim.d3_ = false;
+                    sim.d1_ = true;
+                    sim.schedule_immediately(sim.elevatortask_, 4, now);
+                } else {
+                    if (info.in_ < info.out_) {
+                        sim.callup_[info.in_] = true;
+                    } else {
+                        sim.calldown_[info.in_] = true;
+                    }
+                    if (!sim.d2_ || sim.elevatortask_->nextinst_ == 1) {
+                        sim.decision(now, false);
+                    }
+                }
+                // U3. Enter queue.
+                this->in_ = info.in_;
+                this->out_ = info.out_;
+                sim.occupancy_.queueChanging(this->in_, sim.queue_[this->in_].size());
+                sim.queue_[this->in_].push_back(me);
+                sim.schedule(me, 4, now + info.giveuptime_);
+                this->enteredQueueAt_ = now;
+                sim.stats_.userQueued();
+                return;
+            }
+            case 4: {
+                // U4. Give up.
+                if (!elevator_is_available(this->in_, this->out_) || !sim.d1_) {
+                    sim.occupancy_.queueChanging(this->in_, sim.queue_[this->in_].size());
+                    std_erase(sim.queue_[this->in_], me);
+                    sim.stats_.userWalked(now - this->enteredQueueAt_);
+                    if (sim.userRecords_ != nullptr) {
+                        sim.userRecords_->add(UserRecord{ this->userNumber_, now - this->enteredQueueAt_, 0,
+                            int16_t(this->in_), int16_t(this->out_), 0, 1 });
+                    }
+#if PRINT_STATISTICS
+                    Duration d = now - this->enteredQueueAt_;
+                    printf("User %d walked after %lld.%llds waiting in the queue on floor %d\n", this->userNumber_, d / 10, d % 10, this->in_);
+#endif
+                }
+                return;
+            }
+            case 5: {
+                // U5. Get in.
+                sim.occupancy_.queueChanging(this->in_, sim.queue_[this->in_].size());
+                std_erase(sim.queue_[this->in_], me);
+                sim.elevator_.push_front(me);
+                sim.callcar_[this->out_] = true;
+                if (sim.state_ == Neutral) {
+                    sim.state_ = (this->in_ < this->out_) ? GoingUp : GoingDown;
+                    sim.schedule(sim.e5task_, 5, now + sim.durationBeforeRapidDoorClose);
+                }
+                this->enteredCarAt_ = now;
+                sim.stats_.userBoarded(this->in_, this->out_, now - this->enteredQueueAt_);
+#if PRINT_STATISTICS
+                this->firstStop_ = sim.stopLogEnd();
+#endif
+                if (PRINT_STATISTICS || sim.userRecords_ != nullptr) {
+                    for (auto& user : sim.elevator_) {
+                        user->maxOccupancy_ = std::max(user->maxOccupancy_, int(sim.elevator_.size()));
+                    }
+                }
+                return;
+            }
+            case 6: {
+                // U6. Get out.
+                std_erase(sim.elevator_, me);
+                sim.stats_.userArrived(this->in_, this->out_, this->enteredCarAt_ - this->enteredQueueAt_, now - this->enteredCarAt_);
+                if (sim.userRecords_ != nullptr) {
+                    sim.userRecords_->add(UserRecord{ this->userNumber_, this->enteredCarAt_ - this->enteredQueueAt_,
+                        now - this->enteredCarAt_, int16_t(this->in_), int16_t(this->out_), int16_t(this->maxOccupancy_), 0 });
+                }
+#if PRINT_STATISTICS
+                Duration d1 = this->enteredCarAt_ - this->enteredQueueAt_;
+                Duration d2 = now - this->enteredCarAt_;
+                printf("User %d arrived after %lld.%llds waiting in the queue on floor %d followed by %lld.%llds in the elevator. Max occupancy %d. Stopped at floors",
+                    this->userNumber_, d1 / 10, d1 % 10, this->in_, d2 / 10, d2 % 10, this->maxOccupancy_);
+                for (long long i = this->firstStop_; i < sim.stopLogEnd(); ++i) {
+                    printf(" %d", sim.stopLog_[i - sim.stopLogBase_]);
+                }
+                printf(".\n");
+                if (sim.elevator_.empty()) {
+                    sim.stopLogBase_ = sim.stopLogEnd();
+                    sim.stopLog_.clear();
+                }
+#endif
+                return;
+            }
+        }
+    }
+
+    inline void ElevatorTask::resume(ElevatorSimulation& sim) {
+        Time now = this->nexttime_;
+        std::shared_ptr<Task> me = shared_from_this();
+        assert(me == sim.elevatortask_);
+        switch (this->nextinst_) {
+            case 1: {
+                // E1. Wait for call.
+                assert(sim.floor_ == homeFloor);
+                return;
+            }
+            case 2: {
+                // E2. Change of state?
+                bool passenger_wants_up = false;
+                bool passenger_wants_down = false;
+                bool waiter_wants_up = false;
+                bool waiter_wants_down = false;
+                for (int j=0; j < numberOfFloors; ++j) {
+                    if (j != sim.floor_) {
+                        if (sim.callcar_[j]) {
+                            ((j > sim.floor_) ? passenger_wants_up : passenger_wants_down) = true;
+                        }
+                        if (sim.callup_[j] || sim.calldown_[j]) {
+                            ((j > sim.floor_) ? waiter_wants_up : waiter_wants_down) = true;
+                        }
+                    }
+                }
+                if (sim.state_ == GoingUp && !(passenger_wants_up || waiter_wants_up)) {
+                    sim.state_ = (passenger_wants_down ? GoingDown : Neutral);
+                } else if (sim.state_ == GoingDown && !(passenger_wants_down || waiter_wants_down)) {
+                    sim.state_ = (passenger_wants_up ? GoingUp : Neutral);
+                }
+                goto caseE3;
+            }
+            case 3: caseE3: {
+                // E3. Open doors.
+                sim.d1_ = true;
+                sim.d2_ = true;
+                sim.schedule(sim.e9task_, 9, now + sim.durationBeforeInactivity);
+                sim.schedule(sim.e5task_, 5, now + sim.durationBeforeDoorClose);
+                sim.schedule(me, 4, now + sim.durationOfDoorOpen);
+#if PRINT_STATISTICS
+                if (!sim.elevator_.empty()) {
+                    sim.stopLog_.push_back(sim.floor_);
+                }
+#endif
+                return;
+            }
+            case 4: {
+                // E4. Let people out, in.
+                assert(sim.d1_);
+                auto leaver = std::find_if(sim.elevator_.begin(), sim.elevator_.end(), [&](const auto& p) {
+                    return p->out_ == sim.floor_;
+                });
+                auto enterer = std::find_if(sim.queue_[sim.floor_].begin(), sim.queue_[sim.floor_].end(), [&](const auto& p) {
+#if EXERCISE_SIX
+                    return (sim.state_ == Neutral) || ((p->out_ > sim.floor_) == (sim.state_ == GoingUp));
+#else
+                    (void)p;
+                    return true;
+#endif
+                });
+                if (leaver != sim.elevator_.end()) {
+                    sim.schedule_immediately(*leaver, 6, now);
+                    sim.schedule(me, 4, now + sim.durationOfLeaving);
+                } else if (enterer != sim.queue_[sim.floor_].end()) {
+                    assert((*enterer)->nextinst_ == 4);
+                    sim.schedule_immediately(*enterer, 5, now);
+                    sim.schedule(me, 4, now + sim.durationOfEntering);
+                } else {
+                    sim.d1_ = false;
+                    sim.d3_ = true;
+                }
+                return;
+            }
+            case 6: {
+                // E6. Prepare to move.
+                assert(!sim.d1_);
+                sim.callcar_[sim.floor_] = false;
+                if (sim.state_ != GoingDown) {
+                    sim.callup_[sim.floor_] = false;
+                }
+                if (sim.state_ != GoingUp) {
+                    sim.calldown_[sim.floor_] = false;
+                }
+                sim.decision(now, true);
+                if (sim.state_ == Neutral) {
+                    assert(sim.floor_ == homeFloor);
+                    assert(std::find(sim.wait_.begin(), sim.wait_.end(), me) == sim.wait_.end());
+                    sim.schedule_immediately(me, 1, now);
+                } else {
+                    if (sim.d2_) {
+                        sim.cancel(sim.e9task_);
+                    }
+                    if (sim.state_ == GoingUp) {
+                        sim.schedule(me, 7, now + sim.durationOfUpwardAcceleration);
+                    } else {
+                        sim.schedule(me, 8, now + sim.durationOfDownwardAcceleration);
+                    }
+                }
+                return;
+            }
+            case 7: {
+                // E7. Go up a floor.
+                assert(!sim.d1_);
+                assert(sim.floor_ < numberOfFloors - 1);
+                sim.floor_ += 1;
+                sim.schedule(me, 71, now + sim.durationOfUpwardTravel);
+                return;
+            }
+            case 71: {
+                // E7, continued.
+                bool passenger_wants_up = false;
+                bool passenger_wants_down = false;
+                bool waiter_wants_up = false;
+                bool waiter_wants_down = false;
+                for (int j=0; j < numberOfFloors; ++j) {
+                    if (j != sim.floor_) {
+                        if (sim.callcar_[j]) {
+                            ((j > sim.floor_) ? passenger_wants_up : passenger_wants_down) = true;
+                        }
+                        if (sim.callup_[j] || sim.calldown_[j]) {
+                            ((j > sim.floor_) ? waiter_wants_up : waiter_wants_down) = true;
+                        }
+                    }
+                }
+                bool should_stop_here = sim.callcar_[sim.floor_] ||
+                    sim.callup_[sim.floor_] ||
+                    ((sim.floor_ == homeFloor || sim.calldown_[sim.floor_]) && !(passenger_wants_up || waiter_wants_up));
+                if (should_stop_here) {
+                    sim.schedule(me, 2, now + sim.durationOfUpwardDeceleration);
+                } else {
+                    sim.schedule_immediately(me, 7, now);
+                }
+                return;
+            }
+            case 8: {
+                // E8. Go down a floor.
+                assert(!sim.d1_);
+                assert(sim.floor_ > 0);
+                sim.floor_ -= 1;
+                sim.schedule(me, 81, now + sim.durationOfDownwardTravel);
+                return;
+            }
+            case 81: {
+                // E8, continued.
+                bool passenger_wants_up = false;
+                bool passenger_wants_down = false;
+                bool waiter_wants_up = false;
+                bool waiter_wants_down = false;
+                for (int j=0; j < numberOfFloors; ++j) {
+                    if (j != sim.floor_) {
+                        if (sim.callcar_[j]) {
+                            ((j > sim.floor_) ? passenger_wants_up : passenger_wants_down) = true;
+                        }
+                        if (sim.callup_[j] || sim.calldown_[j]) {
+                            ((j > sim.floor_) ? waiter_wants_up : waiter_wants_down) = true;
+                        }
+                    }
+                }
+                bool should_stop_here = sim.callcar_[sim.floor_] ||
+                    sim.calldown_[sim.floor_] ||
+                    ((sim.floor_ == homeFloor || sim.callup_[sim.floor_]) && !(passenger_wants_down || waiter_wants_down));
+                if (should_stop_here) {
+                    sim.schedule(me, 2, now + sim.durationOfDownwardDeceleration);
+                } else {
+                    sim.schedule_immediately(me, 8, now);
+                }
+                return;
+            }
+            default: {
+                assert(false);
+            }
+        }
+    }
+
+    inline void E5Task::resume(ElevatorSimulation& sim) {
+        Time now = this->nexttime_;
+        std::shared_ptr<Task> me = shared_from_this();
+        assert(me == sim.e5task_);
+        assert(nextinst_ == 5);
+
+        // E5. Close doors.
+        if (sim.d1_) {
+            sim.schedule(me, 5, now + sim.delayAfterDoorFlutter);
+        } else {
+            sim.d3_ = false;
+            sim.schedule(sim.elevatortask_, 6, now + sim.durationOfDoorClose);
+        }
+    }
+
+    inline void E9Task::resume(ElevatorSimulation& sim) {
+        Time now = this->nexttime_;
+        std::shared_ptr<Task> me = shared_from_this();
+        assert(me == sim.e9task_);
+        assert(nextinst_ == 9);
+
+        // E9. Set inaction indicator.
+        sim.d2_ = false;
+        sim.decision(now, false);
+    }
+
+    inline void OccupancyStatistics::advance(Time now, const ElevatorSimulation& sim) {
+        Duration dt = now - last_;
+        last_ = now;
+        if (dt <= 0) {
+            return;
+        }
+        carLoad_ += dt * (long long)sim.elevator_.size();
+        doorsBusy_ += dt * sim.d1_;
+        recentlyActive_ += dt * sim.d2_;
+        doorsIdle_ += dt * sim.d3_;
+        int step = sim.elevatortask_->nextinst_;
+        elevatorStep_[(step >= 10) ? step / 10 : step] += dt;  // E71 counts as E7, E81 as E8
+    }
+
+    inline void OccupancyStatistics::finish(const ElevatorSimulation& sim) {
+        for (int i = 0; i < numberOfFloors; ++i) {
+            this->queueChanging(i, sim.queue_[i].size());
+        }
+    }
@@ -0,0 +1,266 @@
+#pragma once
+
+// Run a batch of independent jobs in forked worker processes, so that a job
+// which crashes takes down only its own worker. Workers claim jobs from a
+// shared counter and hand back results through a ring buffer in anonymous
+// shared memory (a bounded multi-producer queue after Dmitry Vyukov); the
+// parent is the only consumer. A result is a string of bytes of any length,
+// sent through the ring in chunks and put back together by the parent, so
+// the shared memory used doesn't depend on how big the results get.
+//
+// When a worker dies abnormally, the parent starts a replacement, which
+// retries the job the dead worker was running until that job has failed
+// maxAttempts times; chunks left over from a failed attempt (each chunk
+// carries its attempt number) are thrown away. A worker that dies after
+// claiming a ring slot but before filling it would leave the parent waiting
+// on that slot forever, so each worker also advertises the position it is
+// claiming, and the parent skips a claimed slot that no living worker owns.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+struct ProcessEnsemble {
+    static constexpr int ringCapacity = 64;  // must be a power of two
+    static constexpr int chunkBytes = 64 << 10;
+
+    struct RingSlot {
+        std::atomic<unsigned long long> seq_;
+        int job_;
+        int attempt_;    // how many times the job had failed before this try
+        int bytes_;      // of data_ in use
+        bool last_;      // the last chunk of the job's result?
+        char data_[chunkBytes];
+    };
+
+    struct WorkerSlot {
+        std::atomic<int> currentJob_;  // -1 when not running a job
+        std::atomic<unsigned long long> claiming_;  // ring position being claimed or filled, plus 1; 0 if none
+        int firstJob_;                 // job to retry on startup, or -1
+        int firstAttempt_;             // how many times firstJob_ has failed
+    };
+
+    struct SharedState {
+        std::atomic<int> nextJob_;
+        std::atomic<unsigned long long> enqueuePos_;
+        RingSlot ring_[ringCapacity];
+    };
+
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "Atomics must work across processes");
+
+    explicit ProcessEnsemble(int workers, int jobs) : workers_(workers), jobs_(jobs) {
+        bytes_ = sizeof(SharedState) + workers * sizeof(WorkerSlot);
+        void *p = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        shared_ = new (p) SharedState;
+        shared_->nextJob_ = 0;
+        shared_->enqueuePos_ = 0;
+        for (int i = 0; i < ringCapacity; ++i) {
+            shared_->ring_[i].seq_ = i;
+        }
+        slots_ = reinterpret_cast<WorkerSlot*>(shared_ + 1);
+        for (int i = 0; i < workers; ++i) {
+            new (&slots_[i]) WorkerSlot;
+            slots_[i].currentJob_ = -1;
+            slots_[i].claiming_ = 0;
+            slots_[i].firstJob_ = -1;
+            slots_[i].firstAttempt_ = 0;
+        }
+    }
+
+    ProcessEnsemble(const ProcessEnsemble&) = delete;
+    ProcessEnsemble& operator=(const ProcessEnsemble&) = delete;
+    ~ProcessEnsemble() { munmap(shared_, bytes_); }
+
+    // Runs runJob(job), which returns the job's result as a std::vector<char>,
+    // in the workers for every job in [0, jobs), and calls onResult(job, result)
+    // or onFailure(job) exactly once per job, in the parent, in whatever order
+    // the jobs finish.
+    template<class RunJob, class OnResult, class OnFailure>
+    void run(int maxAttempts, const RunJob& runJob, const OnResult& onResult, const OnFailure& onFailure) {
+        std::vector<pid_t> pids(workers_, -1);
+        std::vector<int> attempts(jobs_, 0);
+        std::vector<bool> accounted(jobs_, false);
+        std::vector<std::vector<char>> partial(jobs_);  // chunks received so far
+        int jobsAccounted = 0;
+        int workersAlive = 0;
+        unsigned long long dequeuePos = 0;
+
+        fflush(nullptr);  // so that the children don't inherit unflushed output
+        for (int i = 0; i < workers_; ++i) {
+            pids[i] = this->spawn(i, runJob);
+            workersAlive += 1;
+        }
+
+        while (jobsAccounted < jobs_ || workersAlive > 0) {
+            bool progress = false;
+            while (true) {
+                RingSlot& slot = shared_->ring_[dequeuePos % ringCapacity];
+                if (slot.seq_.load(std::memory_order_acquire) != dequeuePos + 1) {
+                    if (!this->abandoned(dequeuePos)) {
+                        break;
+                    }
+                    fprintf(stderr, "Skipping ring slot %llu, claimed by a worker that died\n", dequeuePos);
+                    slot.seq_.store(dequeuePos + ringCapacity, std::memory_order_release);
+                    dequeuePos += 1;
+                    progress = true;
+                    continue;
+                }
+                int job = slot.job_;
+                if (!accounted[job] && slot.attempt_ == attempts[job]) {
+                    partial[job].insert(partial[job].end(), slot.data_, slot.data_ + slot.bytes_);
+                    if (slot.last_) {
+                        accounted[job] = true;
+                        jobsAccounted += 1;
+                        onResult(job, partial[job]);
+                        std::vector<char>().swap(partial[job]);
+                    }
+                }
+                slot.seq_.store(dequeuePos + ringCapacity, std::memory_order_release);
+                dequeuePos += 1;
+                progress = true;
+            }
+
+            int status;
+            pid_t pid = waitpid(-1, &status, WNOHANG);
+            if (pid > 0) {
+                progress = true;
+                int i = 0;
+                while (i < workers_ && pids[i] != pid) {
+                    ++i;
+                }
+                if (i == workers_) {
+                    continue;
+                }
+                pids[i] = -1;
+                workersAlive -= 1;
+                bool crashed = !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+                if (crashed) {
+                    slots_[i].claiming_ = 0;  // if it claimed a slot, abandoned() now sees that nobody owns it
+                    int job = slots_[i].currentJob_.exchange(-1);
+                    slots_[i].firstJob_ = -1;
+                    if (job >= 0 && !accounted[job]) {
+                        attempts[job] += 1;
+                        std::vector<char>().swap(partial[job]);
+                        fprintf(stderr, "Worker %d died (status %d) running job %d, attempt %d of %d\n",
+                            int(pid), status, job, attempts[job], maxAttempts);
+                        if (attempts[job] < maxAttempts) {
+                            slots_[i].firstJob_ = job;
+                            slots_[i].firstAttempt_ = attempts[job];
+                        } else {
+                            accounted[job] = true;
+                            jobsAccounted += 1;
+                            onFailure(job);
+                        }
+                    }
+                    pids[i] = this->spawn(i, runJob);
+                    workersAlive += 1;
+                }
+            }
+            if (!progress) {
+                usleep(1000);
+            }
+        }
+    }
+
+private:
+    // Has the ring slot at pos been claimed by a worker that has since died
+    // (and been reaped) without filling it? A worker advertises a position
+    // before trying to claim it and withdraws it only after filling the
+    // slot, so if pos has been claimed, and no worker advertises it, and the
+    // slot is still unfilled after that, its owner is gone.
+    bool abandoned(unsigned long long pos) const {
+        if (shared_->enqueuePos_.load() <= pos) {
+            return false;
+        }
+        for (int i = 0; i < workers_; ++i) {
+            if (slots_[i].claiming_.load() == pos + 1) {
+                return false;
+            }
+        }
+        return shared_->ring_[pos % ringCapacity].seq_.load() == pos;
+    }
+
+    template<class RunJob>
+    pid_t spawn(int index, const RunJob& runJob) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        } else if (pid == 0) {
+            this->workerMain(index, runJob);
+            _exit(0);
+        }
+        return pid;
+    }
+
+    template<class RunJob>
+    void workerMain(int index, const RunJob& runJob) {
+        WorkerSlot& me = slots_[index];
+        int job = me.firstJob_;
+        int attempt = me.firstAttempt_;
+        while (true) {
+            if (job < 0) {
+                job = shared_->nextJob_.fetch_add(1);
+                attempt = 0;
+                if (job >= jobs_) {
+                    return;
+                }
+            }
+            me.currentJob_ = job;
+            std::vector<char> result = runJob(job);
+            size_t sent = 0;
+            do {
+                size_t n = std::min(result.size() - sent, size_t(chunkBytes));
+                this->push(me, job, attempt, result.data() + sent, n, sent + n == result.size());
+                sent += n;
+            } while (sent != result.size());
+            me.currentJob_ = -1;
+            job = -1;
+        }
+    }
+
+    void push(WorkerSlot& me, int job, int attempt, const char *data, size_t n, bool last) {
+        unsigned long long pos = shared_->enqueuePos_.load(std::memory_order_relaxed);
+        RingSlot *slot;
+        while (true) {
+            slot = &shared_->ring_[pos % ringCapacity];
+            unsigned long long seq = slot->seq_.load(std::memory_order_acquire);
+            long long diff = (long long)(seq - pos);
+            if (diff == 0) {
+                me.claiming_.store(pos + 1);
+                if (shared_->enqueuePos_.compare_exchange_weak(pos, pos + 1)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                usleep(100);  // the ring is full; wait for the parent to drain it
+                pos = shared_->enqueuePos_.load(std::memory_order_relaxed);
+            } else {
+                pos = shared_->enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->job_ = job;
+        slot->attempt_ = attempt;
+        slot->bytes_ = int(n);
+        slot->last_ = last;
+        memcpy(slot->data_, data, n);
+        slot->seq_.store(pos + 1);
+        me.claiming_.store(0);
+    }
+
+    int workers_;
+    int jobs_;
+    size_t bytes_;
+    SharedState *shared_;
+    WorkerSlot *slots_;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+// Hardware performance counters via Linux's perf_event_open(2).
+// The counters are opened as a single group, so that they are always
+// scheduled onto the PMU together and their ratios (such as instructions
+// per cycle) are meaningful. Counters the machine doesn't support are
+// skipped; if none can be opened (not Linux, or perf_event_paranoid
+// forbids it), available() is false and every reading is zero.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct PerfCounterValues {
+    enum Counter { Cycles, Instructions, CacheReferences, CacheMisses, Branches, BranchMisses, NumberOfCounters };
+    unsigned long long values_[NumberOfCounters] = {};
+
+    unsigned long long operator[](Counter c) const { return values_[c]; }
+
+    PerfCounterValues& operator+=(const PerfCounterValues& rhs) {
+        for (int i = 0; i < NumberOfCounters; ++i) {
+            values_[i] += rhs.values_[i];
+        }
+        return *this;
+    }
+
+    friend PerfCounterValues operator-(PerfCounterValues lhs, const PerfCounterValues& rhs) {
+        for (int i = 0; i < NumberOfCounters; ++i) {
+            lhs.values_[i] -= rhs.values_[i];
+        }
+        return lhs;
+    }
+
+    double ipc() const {
+        return values_[Cycles] ? double(values_[Instructions]) / values_[Cycles] : 0.0;
+    }
+
+    void print(FILE *fp, const char *label) const {
+        auto ratio = [](unsigned long long a, unsigned long long b) { return b ? 100.0 * a / b : 0.0; };
+        fprintf(fp, "# %s: %llu cycles, %llu instructions (IPC %.2f)\n",
+            label, values_[Cycles], values_[Instructions], this->ipc());
+        fprintf(fp, "#   %llu cache misses of %llu references (%.2f%%); %llu branch mispredicts of %llu branches (%.2f%%)\n",
+            values_[CacheMisses], values_[CacheReferences], ratio(values_[CacheMisses], values_[CacheReferences]),
+            values_[BranchMisses], values_[Branches], ratio(values_[BranchMisses], values_[Branches]));
+    }
+};
+
+class PerfCounters {
+public:
+    PerfCounters() {
+#ifdef __linux__
+        static const unsigned long long configs[PerfCounterValues::NumberOfCounters] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_REFERENCES,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        for (int i = 0; i < PerfCounterValues::NumberOfCounters; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof attr);
+            attr.size = sizeof attr;
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = (leader_ < 0);
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            if (fd < 0) {
+                if (error_ == 0) {
+                    error_ = errno;
+                }
+                continue;
+            }
+            if (leader_ < 0) {
+                leader_ = fd;
+            }
+            fds_[opened_] = fd;
+            which_[opened_] = i;
+            opened_ += 1;
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int i = 0; i < opened_; ++i) {
+            close(fds_[i]);
+        }
+#endif
+    }
+
+    bool available() const { return opened_ != 0; }
+    const char *error() const { return error_ ? strerror(error_) : "not supported on this platform"; }
+
+    void start() {
+#ifdef __linux__
+        if (available()) {
+            ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        if (available()) {
+            ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    // The counts since start(). Reading costs a system call, so reading
+    // around every event is much slower than reading around a whole run.
+    PerfCounterValues read() const {
+        PerfCounterValues result;
+#ifdef __linux__
+        unsigned long long buf[1 + PerfCounterValues::NumberOfCounters];
+        if (available() && ::read(leader_, buf, sizeof buf) > 0) {
+            for (int i = 0; i < opened_ && i < int(buf[0]); ++i) {
+                result.values_[which_[i]] = buf[1 + i];
+            }
+        }
+#endif
+        return result;
+    }
+
+private:
+    int leader_ = -1;
+    int opened_ = 0;
+    int error_ = 0;
+    int fds_[PerfCounterValues::NumberOfCounters] = {};
+    int which_[PerfCounterValues::NumberOfCounters] = {};
+};
@@ -0,0 +1,391 @@
+// Microbenchmarks for the random number generation on the simulator's
+// arrival path: raw 64-bit generation, bounded integers, floating-point
+// uniforms, and ElevatorSimulation::createNewUser itself.
+// Each benchmark is run several times and the fastest run is reported.
+//
+//     make rngbench && ./rngbench [draws]
+//     ./rngbench --check
+//
+// --check instead verifies that every lane of xoshiro256ss_lanes reproduces
+// the scalar generator jumped to the same stream, that the ziggurat
+// samplers, tick helpers and alias tables have the right distributions,
+// and exits nonzero if not.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "alias_table.h"
+#include "elevator_simulation.h"
+#include "xoshiro256ss.h"
+#include "ziggurat.h"
+
+using u64 = xoshiro256ss::u64;
+
+// Keeps the compiler from discarding a benchmark's work.
+static volatile u64 sink;
+
+template<class F>
+void measure(const char *name, long long draws, F f, const char *unit = "draw")
+{
+    double best = 1e300;
+    for (int trial = 0; trial < 5; ++trial) {
+        u64 sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < draws; ++i) {
+            sum += f();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sink = sink + sum;
+        best = std::min(best, seconds);
+    }
+    printf("%-40s %8.3f ns/%s %10.1f M %ss/s\n", name, 1e9 * best / draws, unit, draws / best / 1e6, unit);
+}
+
+// The bounded-integer methods under comparison, each returning a value in
+// [0, range). The simulator uses xoshiro256ss::bounded, or modulo under --modulo.
+inline u64 boundedModulo(xoshiro256ss& g, u64 range)
+{
+    return g() % range;
+}
+
+// Scaling a 53-bit double; slightly biased for ranges that aren't powers of two.
+inline u64 boundedDouble(xoshiro256ss& g, u64 range)
+{
+    return u64(double(g() >> 11) * (1.0 / 9007199254740992.0) * double(range));
+}
+
+inline double uniformDouble(xoshiro256ss& g)
+{
+    return double(g() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Does lane k of xoshiro256ss_lanes<Lanes> match a scalar generator that
+// was jumped k times, both in its outputs and in its state afterward?
+template<int Lanes>
+bool checkLanes(size_t n)
+{
+    xoshiro256ss seed(12345);
+    xoshiro256ss_lanes<Lanes> lanes(seed);
+    std::vector<u64> out(n);
+    lanes.fill(out.data(), n);
+    size_t steps = (n + Lanes - 1) / Lanes;
+    xoshiro256ss g = seed;
+    for (int k = 0; k < Lanes; ++k) {
+        for (size_t i = 0; i < steps; ++i) {
+            u64 expected = g();
+            if (i * Lanes + k < n && out[i * Lanes + k] != expected) {
+                printf("FAIL: %d lanes, %zu outputs: lane %d output %zu is %llu, not %llu\n",
+                    Lanes, n, k, i, out[i * Lanes + k], expected);
+                return false;
+            }
+        }
+        xoshiro256ss after = lanes.lane(k);
+        if (memcmp(after.s, g.s, sizeof g.s) != 0) {
+            printf("FAIL: %d lanes, %zu outputs: lane %d ends in the wrong state\n", Lanes, n, k);
+            return false;
+        }
+        g = seed;
+        for (int j = 0; j <= k; ++j) {
+            g.jump();
+        }
+    }
+    return true;
+}
+
+// Do the ziggurat samplers have the right mean and variance, and put the
+// right mass above a point inside the layers and a point in the tail?
+bool checkZiggurat()
+{
+    const long long n = 10'000'000;
+    struct Case {
+        const char *name;
+        double (*sample)(xoshiro256ss&);
+        double mean, variance;
+        double points[2];
+        double above[2];  // P(X > points[i])
+    };
+    static const Case cases[] = {
+        { "exponential", exponentialVariate, 1, 1, { 1, 8 }, { std::exp(-1.0), std::exp(-8.0) } },
+        { "normal", normalVariate, 0, 1, { 1, 3.7 }, { 0.5 * std::erfc(1 / std::sqrt(2.0)), 0.5 * std::erfc(3.7 / std::sqrt(2.0)) } },
+    };
+    bool ok = true;
+    for (const Case& c : cases) {
+        xoshiro256ss g(6);
+        double sum = 0, sumsq = 0;
+        long long above[2] = {};
+        for (long long i = 0; i < n; ++i) {
+            double x = c.sample(g);
+            sum += x;
+            sumsq += x * x;
+            above[0] += (x > c.points[0]);
+            above[1] += (x > c.points[1]);
+        }
+        double mean = sum / n;
+        double variance = sumsq / n - mean * mean;
+        // Allow six standard errors.
+        bool good = std::fabs(mean - c.mean) < 6 * std::sqrt(c.variance / n)
+                 && std::fabs(variance - c.variance) < 0.01;
+        for (int j = 0; j < 2; ++j) {
+            double p = c.above[j];
+            good = good && std::fabs(double(above[j]) / n - p) < 6 * std::sqrt(p * (1 - p) / n);
+        }
+        if (!good) {
+            printf("FAIL: %s sampler: mean %.5f, variance %.5f, P(X > %g) = %.3g, P(X > %g) = %.3g\n",
+                c.name, mean, variance, c.points[0], double(above[0]) / n, c.points[1], double(above[1]) / n);
+        }
+        ok = ok && good;
+    }
+    printf("%s: the ziggurat samplers have the right distributions\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Do the tick helpers round correctly, and do the durations they draw have
+// the right distributions? Each case is checked at P(T <= lo) and P(T >= hi).
+bool checkTicks()
+{
+    bool ok = (roundToTicks(-3.2) == 0 && roundToTicks(0) == 0 && roundToTicks(0.49) == 0
+            && roundToTicks(0.5) == 1 && roundToTicks(2.5) == 3 && roundToTicks(1e12 + 0.25) == 1000000000000LL);
+    if (!ok) {
+        printf("FAIL: roundToTicks\n");
+    }
+    auto normalBelow = [](double z) { return 0.5 * std::erfc(-z / std::sqrt(2.0)); };
+    const double mu = std::log(100.0);
+    struct Case {
+        const char *name;
+        long long (*sample)(xoshiro256ss&);
+        long long lo, hi;
+        double below, above;  // P(T <= lo), P(T >= hi)
+    };
+    const Case cases[] = {
+        { "exponentialTicks(100)", [](xoshiro256ss& g) { return exponentialTicks(g, 100); },
+            0, 200, 1 - std::exp(-0.005), std::exp(-1.995) },
+        { "normalTicks(50, 10)", [](xoshiro256ss& g) { return normalTicks(g, 50, 10); },
+            50, 70, normalBelow(0.05), 1 - normalBelow(1.95) },
+        { "normalTicks(0, 10)", [](xoshiro256ss& g) { return normalTicks(g, 0, 10); },
+            0, 10, normalBelow(0.05), 1 - normalBelow(0.95) },
+        { "lognormalTicks(log 100, 0.5)", [](xoshiro256ss& g) { return lognormalTicks(g, std::log(100.0), 0.5); },
+            100, 300, normalBelow((std::log(100.5) - mu) / 0.5), 1 - normalBelow((std::log(299.5) - mu) / 0.5) },
+    };
+    const long long n = 4'000'000;
+    for (const Case& c : cases) {
+        xoshiro256ss g(8);
+        long long below = 0, above = 0, negative = 0;
+        for (long long i = 0; i < n; ++i) {
+            long long t = c.sample(g);
+            below += (t <= c.lo);
+            above += (t >= c.hi);
+            negative += (t < 0);
+        }
+        // Allow six standard errors.
+        bool good = (negative == 0)
+                 && std::fabs(double(below) / n - c.below) < 6 * std::sqrt(c.below * (1 - c.below) / n)
+                 && std::fabs(double(above) / n - c.above) < 6 * std::sqrt(c.above * (1 - c.above) / n);
+        if (!good) {
+            printf("FAIL: %s: P(T <= %lld) = %.4g (expected %.4g), P(T >= %lld) = %.4g (expected %.4g), %lld negative\n",
+                c.name, c.lo, double(below) / n, c.below, c.hi, double(above) / n, c.above, negative);
+        }
+        ok = ok && good;
+    }
+    printf("%s: the tick helpers round and are distributed correctly\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Does an alias table pick each outcome in proportion to its weight, and
+// never pick one of zero weight?
+bool checkAliasTable()
+{
+    const long long n = 4'000'000;
+    xoshiro256ss g(7);
+    std::vector<double> weights(100);
+    double total = 0;
+    for (size_t i = 0; i < weights.size(); ++i) {
+        weights[i] = (i % 7 == 3) ? 0 : double(g() % 1000);
+        total += weights[i];
+    }
+    AliasTable table;
+    table.build(weights);
+    std::vector<long long> counts(weights.size());
+    for (long long i = 0; i < n; ++i) {
+        counts[table.sample(uniformDouble(g))] += 1;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < weights.size(); ++i) {
+        double p = weights[i] / total;
+        if (std::fabs(double(counts[i]) / n - p) > 6 * std::sqrt(p * (1 - p) / n) + (p == 0 ? 0 : 1e-9)) {
+            printf("FAIL: alias table picked outcome %zu %lld times, expected about %.0f\n", i, counts[i], p * n);
+            ok = false;
+        }
+    }
+    printf("%s: alias tables pick outcomes in proportion to their weights\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int checkAllLanes()
+{
+    bool ok = true;
+    for (size_t n : { 0, 1, 7, 1000, 1003 }) {
+        ok = checkLanes<1>(n) && ok;
+        ok = checkLanes<3>(n) && ok;
+        ok = checkLanes<4>(n) && ok;
+        ok = checkLanes<8>(n) && ok;
+        ok = checkLanes<12>(n) && ok;
+        ok = checkLanes<16>(n) && ok;
+    }
+    printf("%s: xoshiro256ss_lanes matches the scalar generator\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "--check") == 0) {
+        bool ok = (checkAllLanes() == 0);
+        ok = checkZiggurat() && ok;
+        ok = checkTicks() && ok;
+        ok = checkAliasTable() && ok;
+        return ok ? 0 : 1;
+    }
+    long long draws = (argc > 1) ? atoll(argv[1]) : 50'000'000;
+    if (draws <= 0) {
+        fprintf(stderr, "usage: %s [draws]\n", argv[0]);
+        return 1;
+    }
+
+    printf("# raw 64-bit generation\n");
+    {
+        xoshiro256ss g(1);
+        measure("xoshiro256**", draws, [&]() { return g(); });
+        u64 x = 1;
+        measure("splitmix64", draws, [&]() { return xoshiro256ss::splitmix64(x); });
+        std::mt19937_64 mt(1);
+        measure("std::mt19937_64", draws, [&]() { return mt(); });
+        std::minstd_rand lcg(1);
+        measure("std::minstd_rand", draws, [&]() { return u64(lcg()); });
+    }
+
+    printf("# bulk generation with xoshiro256ss_lanes::fill, in blocks of 1024\n");
+    {
+        std::vector<u64> block(1024);
+        size_t used = block.size();
+        xoshiro256ss_lanes<4> four(xoshiro256ss(1));
+        measure("4 lanes", draws, [&]() {
+            if (used == block.size()) {
+                four.fill(block.data(), block.size());
+                used = 0;
+            }
+            return block[used++];
+        });
+        used = block.size();
+        xoshiro256ss_lanes<8> eight(xoshiro256ss(1));
+        measure("8 lanes", draws, [&]() {
+            if (used == block.size()) {
+                eight.fill(block.data(), block.size());
+                used = 0;
+            }
+            return block[used++];
+        });
+    }
+
+    printf("# bounded integers\n");
+    for (u64 range : { 5uLL, 891uLL, (1uLL << 63) + 1 }) {
+        char name[100];
+        xoshiro256ss g(2);
+        snprintf(name, sizeof name, "modulo, range %llu", range);
+        measure(name, draws, [&]() { return boundedModulo(g, range); });
+        snprintf(name, sizeof name, "Lemire, range %llu", range);
+        measure(name, draws, [&]() { return g.bounded(range); });
+        snprintf(name, sizeof name, "double scaling, range %llu", range);
+        measure(name, draws, [&]() { return boundedDouble(g, range); });
+        std::uniform_int_distribution<u64> dist(0, range - 1);
+        snprintf(name, sizeof name, "uniform_int_distribution, range %llu", range);
+        measure(name, draws, [&]() { return dist(g); });
+    }
+
+    printf("# floating-point uniforms in [0, 1)\n");
+    {
+        xoshiro256ss g(3);
+        measure("53-bit multiply", draws, [&]() { return u64(uniformDouble(g) * 1e6); });
+        std::uniform_real_distribution<double> dist(0.0, 1.0);
+        measure("uniform_real_distribution", draws, [&]() { return u64(dist(g) * 1e6); });
+    }
+
+    printf("# exponential and normal variates\n");
+    {
+        xoshiro256ss g(5);
+        measure("exponential, by inversion (-log)", draws, [&]() { return u64(-std::log1p(-uniformDouble(g)) * 1e6); });
+        measure("exponential, ziggurat", draws, [&]() { return u64(exponentialVariate(g) * 1e6); });
+        std::exponential_distribution<double> exp1;
+        measure("std::exponential_distribution", draws, [&]() { return u64(exp1(g) * 1e6); });
+        measure("normal, ziggurat", draws, [&]() { return u64(normalVariate(g) * 1e6); });
+        std::normal_distribution<double> norm1;
+        measure("std::normal_distribution", draws, [&]() { return u64(norm1(g) * 1e6); });
+    }
+
+    printf("# origin-destination pairs, for 5 and 100 floors\n");
+    for (int floors : { 5, 100 }) {
+        xoshiro256ss g(8);
+        std::vector<double> od(floors * floors);
+        for (int i = 0; i < floors; ++i) {
+            for (int j = 0; j < floors; ++j) {
+                od[i * floors + j] = (i == j) ? 0 : (i == 0 || j == 0) ? 50 : 1 + double(g() % 4);
+            }
+        }
+        AliasTable table;
+        table.build(od);
+        char name[100];
+        snprintf(name, sizeof name, "alias table, %d floors", floors);
+        measure(name, draws, [&]() { return u64(table.sample(uniformDouble(g))); });
+        double total = 0;
+        for (double w : od) {
+            total += w;
+        }
+        snprintf(name, sizeof name, "linear search, %d floors", floors);
+        measure(name, draws / floors, [&]() {
+            double x = uniformDouble(g) * total;
+            size_t k = 0;
+            while (k + 1 < od.size() && x >= od[k]) {
+                x -= od[k++];
+            }
+            return u64(k);
+        });
+    }
+
+    // createNewUser for each random user, with the default parameters. It
+    // hands out users that refillUserBlock drew 64 at a time: floor in,
+    // floor out, give-up time, and time until the next arrival, either from
+    // a block of raw outputs or, under --crn or time-of-day traffic, one
+    // user at a time from drawRandomUser.
+    printf("# createNewUser (four draws per user)\n");
+    {
+        TrafficProfile office = TrafficProfile::office(numberOfFloors);
+        struct Variant {
+            const char *name;
+            bool modulo, crn, antithetic;
+            const TrafficProfile *traffic;
+        } variants[] = {
+            { "plain", false, false, false, nullptr },
+            { "--modulo", true, false, false, nullptr },
+            { "--crn", false, true, false, nullptr },
+            { "--traffic office", false, false, false, &office },
+            { "--traffic office --antithetic", false, false, true, &office },
+        };
+        for (const Variant& v : variants) {
+            auto sim = std::make_unique<ElevatorSimulation>(4);
+            sim->trace_ = false;
+            sim->moduloBounded_ = v.modulo;
+            sim->commonRandomNumbers_ = v.crn;
+            sim->antithetic_ = v.antithetic;
+            sim->antitheticPair_ = v.antithetic;
+            sim->traffic_ = v.traffic;
+            measure(v.name, draws / 4, [&]() {
+                ElevatorSimulation::NewUserInfo u = sim->createNewUser();
+                return u64(u.in_ + u.out_ + u.giveuptime_ + u.intertime_);
+            }, "user");
+        }
+    }
+}
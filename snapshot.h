@@ -0,0 +1,132 @@
+#pragma once
+
+// Compact binary snapshots. A SnapshotWriter appends values to a byte
+// buffer and a SnapshotReader takes them back out in the same order, so a
+// class can describe its state once, in a template that calls io() on
+// each field, and use the same template to save and to restore it.
+// Plain values are copied byte for byte (snapshots are only meant to be
+// read back by the same build on the same machine); histograms, which are
+// mostly empty, are stored as their range and their nonzero buckets only.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "statistics.h"
+
+class SnapshotWriter {
+public:
+    template<class T>
+    void io(const T& x) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be copied into a snapshot");
+        const char *p = reinterpret_cast<const char*>(&x);
+        bytes_.insert(bytes_.end(), p, p + sizeof x);
+    }
+
+    void io(const LogHistogram& h) {
+        int32_t nonzero = 0;
+        for (long long c : h.counts_) {
+            nonzero += (c != 0);
+        }
+        this->io(nonzero);
+        this->io(h.min_);
+        this->io(h.max_);
+        for (int32_t i = 0; i < LogHistogram::numBuckets; ++i) {
+            if (h.counts_[i] != 0) {
+                this->io(i);
+                this->io(h.counts_[i]);
+            }
+        }
+    }
+
+    const std::vector<char>& bytes() const { return bytes_; }
+
+    // Returns false, having printed why, if the file can't be written.
+    bool writeFile(const char *path) const {
+        FILE *fp = fopen(path, "wb");
+        if (fp == nullptr) {
+            perror(path);
+            return false;
+        }
+        bool ok = (fwrite(bytes_.data(), 1, bytes_.size(), fp) == bytes_.size());
+        ok = (fclose(fp) == 0) && ok;
+        if (!ok) {
+            perror(path);
+        }
+        return ok;
+    }
+
+private:
+    std::vector<char> bytes_;
+};
+
+class SnapshotReader {
+public:
+    SnapshotReader(const char *data, size_t n) : next_(data), end_(data + n) {}
+
+    // Past the end of the data, values read as zero and ok() becomes false.
+    template<class T>
+    void io(T& x) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be copied from a snapshot");
+        if (size_t(end_ - next_) < sizeof x) {
+            memset(static_cast<void*>(&x), 0, sizeof x);
+            ok_ = false;
+            next_ = end_;
+            return;
+        }
+        memcpy(static_cast<void*>(&x), next_, sizeof x);
+        next_ += sizeof x;
+    }
+
+    void io(LogHistogram& h) {
+        h.clear();
+        int32_t nonzero = 0;
+        this->io(nonzero);
+        this->io(h.min_);
+        this->io(h.max_);
+        for (int32_t k = 0; k < nonzero && ok_; ++k) {
+            int32_t i = 0;
+            long long c = 0;
+            this->io(i);
+            this->io(c);
+            if (i < 0 || i >= LogHistogram::numBuckets) {
+                ok_ = false;
+                return;
+            }
+            h.counts_[i] = c;
+            h.total_ += c;
+        }
+    }
+
+    void fail() { ok_ = false; }
+    bool ok() const { return ok_; }
+    bool atEnd() const { return next_ == end_; }
+
+    // Read a whole file into bytes; returns false, having printed why, on failure.
+    static bool readFile(const char *path, std::vector<char>& bytes) {
+        FILE *fp = fopen(path, "rb");
+        if (fp == nullptr) {
+            perror(path);
+            return false;
+        }
+        bytes.clear();
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof buf, fp)) != 0) {
+            bytes.insert(bytes.end(), buf, buf + n);
+        }
+        bool ok = !ferror(fp);
+        fclose(fp);
+        if (!ok) {
+            perror(path);
+        }
+        return ok;
+    }
+
+private:
+    const char *next_;
+    const char *end_;
+    bool ok_ = true;
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+// Streaming summary statistics.
+// RunningStats uses Welford's online algorithm, so that mean and variance
+// can be accumulated one sample at a time without storing the samples.
+// Both RunningStats and LogHistogram can be merged, so each thread (or each
+// simulation) can keep its own and combine them at the end.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+struct RunningStats {
+    long long count_ = 0;
+    double mean_ = 0;
+    double m2_ = 0;  // sum of squared deviations from the mean
+    double min_ = std::numeric_limits<double>::infinity();
+    double max_ = -std::numeric_limits<double>::infinity();
+
+    void add(double x) {
+        count_ += 1;
+        double delta = x - mean_;
+        mean_ += delta / count_;
+        m2_ += delta * (x - mean_);
+        min_ = std::min(min_, x);
+        max_ = std::max(max_, x);
+    }
+
+    // Combine with another set of samples, as if every sample had been
+    // added to *this (Chan, Golub and LeVeque, 1979). This is associative,
+    // so partial results can be merged in any order.
+    void merge(const RunningStats& rhs) {
+        if (rhs.count_ == 0) {
+            return;
+        }
+        long long n = count_ + rhs.count_;
+        double delta = rhs.mean_ - mean_;
+        mean_ += delta * rhs.count_ / n;
+        m2_ += rhs.m2_ + delta * delta * (double(count_) * rhs.count_ / n);
+        count_ = n;
+        min_ = std::min(min_, rhs.min_);
+        max_ = std::max(max_, rhs.max_);
+    }
+
+    long long count() const { return count_; }
+    double mean() const { return mean_; }
+    double variance() const { return (count_ >= 2) ? m2_ / (count_ - 1) : 0.0; }
+    double stddev() const { return std::sqrt(variance()); }
+    double stderror() const { return (count_ >= 1) ? std::sqrt(variance() / count_) : 0.0; }
+    double min() const { return min_; }
+    double max() const { return max_; }
+};
+
+// A log-linear histogram in the style of HdrHistogram: values below 2^S are
+// counted exactly, and each larger power-of-two range [2^k, 2^(k+1)) is split
+// into 2^(S-1) equal sub-buckets, so that every recorded value is known to
+// within a relative error of 2^(1-S) (about 3% for S = 5). The memory is fixed
+// and histograms with the same parameters merge by adding their counts.
+// The exact smallest and largest values are kept too, so that a quantile
+// never lies outside the range of the values actually recorded.
+struct LogHistogram {
+    static constexpr int S = 5;
+    static constexpr int maxBits = 40;  // values of 2^40 or more go into the last bucket
+    static constexpr int numBuckets = (1 << S) + (maxBits - S) * (1 << (S - 1));
+
+    long long counts_[numBuckets] = {};
+    long long total_ = 0;
+    long long min_ = std::numeric_limits<long long>::max();
+    long long max_ = std::numeric_limits<long long>::min();
+
+    static int bucketFor(unsigned long long v) {
+        if (v < (1uLL << S)) {
+            return int(v);
+        }
+        int msb = 63 - __builtin_clzll(v);
+        if (msb >= maxBits) {
+            return numBuckets - 1;
+        }
+        int shift = msb - S + 1;
+        return (1 << S) + (shift - 1) * (1 << (S - 1)) + int(v >> shift) - (1 << (S - 1));
+    }
+
+    // The smallest value that falls into bucket i.
+    static unsigned long long lowestValueIn(int i) {
+        if (i < (1 << S)) {
+            return i;
+        }
+        int shift = (i - (1 << S)) / (1 << (S - 1)) + 1;
+        unsigned long long sub = (i - (1 << S)) % (1 << (S - 1)) + (1 << (S - 1));
+        return sub << shift;
+    }
+
+    static unsigned long long highestValueIn(int i) {
+        return (i == numBuckets - 1) ? ~0uLL : lowestValueIn(i + 1) - 1;
+    }
+
+    void add(long long v) {
+        v = std::max(v, 0LL);
+        counts_[bucketFor(v)] += 1;
+        total_ += 1;
+        min_ = std::min(min_, v);
+        max_ = std::max(max_, v);
+    }
+
+    void clear() {
+        std::fill(counts_, counts_ + numBuckets, 0);
+        total_ = 0;
+        min_ = std::numeric_limits<long long>::max();
+        max_ = std::numeric_limits<long long>::min();
+    }
+
+    void merge(const LogHistogram& rhs) {
+        for (int i = 0; i < numBuckets; ++i) {
+            counts_[i] += rhs.counts_[i];
+        }
+        total_ += rhs.total_;
+        min_ = std::min(min_, rhs.min_);
+        max_ = std::max(max_, rhs.max_);
+    }
+
+    long long count() const { return total_; }
+    long long min() const { return (total_ != 0) ? min_ : 0; }
+    long long max() const { return (total_ != 0) ? max_ : 0; }
+
+    // Write the nonzero buckets as space-separated "lowest:count" pairs,
+    // where lowest is the smallest value that falls into the bucket.
+    void dumpBuckets(FILE *fp) const {
+        const char *sep = "";
+        for (int i = 0; i < numBuckets; ++i) {
+            if (counts_[i] != 0) {
+                fprintf(fp, "%s%llu:%lld", sep, lowestValueIn(i), counts_[i]);
+                sep = " ";
+            }
+        }
+    }
+
+    // The q'th quantile (0 <= q <= 1), reported as the midpoint of the
+    // bucket that contains it, clamped to [min(), max()].
+    double quantile(double q) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        long long rank = std::max(1LL, (long long)std::ceil(q * total_));
+        long long seen = 0;
+        for (int i = 0; i < numBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                double mid = (double(lowestValueIn(i)) + double(highestValueIn(i))) / 2;
+                return std::min(std::max(mid, double(min_)), double(max_));
+            }
+        }
+        return double(max_);
+    }
+};
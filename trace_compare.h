@@ -0,0 +1,98 @@
+#pragma once
+
+// Compare a trace, one line at a time as it is produced, against a golden
+// trace stored in a file. The golden file is read into memory once, and
+// each line is checked as soon as it is produced, so a run that diverges
+// can stop at the first differing event rather than run to completion.
+// On divergence, report() prints the line number, the expected and actual
+// lines, and the few golden lines leading up to it.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+class TraceComparator {
+public:
+    static constexpr int contextLines = 5;
+
+    explicit TraceComparator(const char *path) : path_(path) {}
+
+    // Read the golden trace; returns false (having printed why) on failure.
+    bool load() {
+        FILE *fp = fopen(path_, "rb");
+        if (fp == nullptr) {
+            perror(path_);
+            return false;
+        }
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof buf, fp)) != 0) {
+            golden_.append(buf, n);
+        }
+        fclose(fp);
+        return true;
+    }
+
+    // Check the next line of the trace (without its newline). Returns false
+    // once the trace has diverged from the golden trace.
+    bool matches(const char *line) {
+        if (diverged_) {
+            return false;
+        }
+        size_t end = golden_.find('\n', pos_);
+        if (end == std::string::npos) {
+            end = golden_.size();
+        }
+        size_t len = strlen(line);
+        if (pos_ >= golden_.size() || end - pos_ != len || memcmp(golden_.data() + pos_, line, len) != 0) {
+            diverged_ = true;
+            actual_ = line;
+            return false;
+        }
+        lines_ += 1;
+        pos_ = end + 1;
+        return true;
+    }
+
+    // Call at the end of the run: the trace must also not stop early.
+    bool finish() {
+        if (!diverged_ && pos_ < golden_.size()) {
+            diverged_ = true;
+            actual_ = "(end of trace)";
+        }
+        return !diverged_;
+    }
+
+    void report(FILE *fp) const {
+        if (!diverged_) {
+            fprintf(fp, "%s: %lld lines match\n", path_, lines_);
+            return;
+        }
+        fprintf(fp, "%s:%lld: first divergence after %lld matching lines\n", path_, lines_ + 1, lines_);
+        size_t start = pos_;
+        for (int i = 0; i < contextLines && start > 0; ++i) {
+            size_t nl = (start >= 2) ? golden_.rfind('\n', start - 2) : std::string::npos;
+            start = (nl == std::string::npos) ? 0 : nl + 1;
+        }
+        if (start < pos_) {
+            fprintf(fp, "  context:\n");
+            fprintf(fp, "%.*s", int(pos_ - start), golden_.data() + start);
+        }
+        size_t end = golden_.find('\n', pos_);
+        if (pos_ >= golden_.size()) {
+            fprintf(fp, "  expected: (end of trace)\n");
+        } else {
+            end = (end == std::string::npos) ? golden_.size() : end;
+            fprintf(fp, "  expected: %.*s\n", int(end - pos_), golden_.data() + pos_);
+        }
+        fprintf(fp, "  actual:   %s\n", actual_.c_str());
+    }
+
+private:
+    const char *path_;
+    std::string golden_;
+    std::string actual_;
+    size_t pos_ = 0;       // start of the next golden line
+    long long lines_ = 0;  // lines matched so far
+    bool diverged_ = false;
+};
@@ -0,0 +1,317 @@
+#pragma once
+
+// Time-of-day traffic: a non-homogeneous Poisson arrival process whose rate
+// is constant within each period of the day (night, morning up-peak, lunch,
+// evening down-peak, ...), together with a per-period mix of origin and
+// destination floors. The profile repeats every 24 hours.
+//
+// Arrivals are generated by inverting the piecewise-linear cumulative rate:
+// an Exp(1) variate is "spent" across the periods, at each period's rate,
+// until it runs out. That is exact, needs one uniform per arrival, and is
+// O(1) amortized, since each period boundary is crossed at most once.
+//
+// Floors are picked by alias tables, built when each period is added, so
+// picking costs O(1) per user however many floors there are. A period can
+// give either separate origin and destination weights, or a full matrix of
+// origin-destination weights.
+//
+// A TrafficProfile is immutable once built, so many simulations (in many
+// threads) can share one; each simulation keeps its own TrafficState.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "alias_table.h"
+
+struct TrafficState {
+    double clock_ = 0;  // the time of the latest arrival, in ticks
+    int period_ = 0;    // the period containing clock_
+};
+
+class TrafficProfile {
+public:
+    static constexpr double ticksPerDay = 24 * 60 * 60 * 10;
+
+    struct Period {
+        double start_;                    // ticks after midnight
+        double rate_;                     // arrivals per tick
+        std::vector<double> inWeights_;   // relative weight of each origin floor
+        std::vector<double> outWeights_;  // relative weight of each destination floor
+        std::vector<double> od_;          // if not empty, od_[in * floors + out] replaces both
+
+        AliasTable origins_;
+        std::vector<AliasTable> destinations_;  // for each origin, over the other floors
+        AliasTable pairs_;                      // over in * floors + out, if od_ is given
+    };
+
+    explicit TrafficProfile(int floors) : floors_(floors) {}
+
+    int floors() const { return floors_; }
+    const std::vector<Period>& periods() const { return periods_; }
+
+    // Add a period starting at the given time of day; periods must be added
+    // in order, starting at 00:00. Empty weights mean "all floors alike".
+    void addPeriod(int hours, int minutes, double arrivalsPerHour,
+                   std::vector<double> inWeights = {}, std::vector<double> outWeights = {}) {
+        Period p;
+        p.start_ = (hours * 60 + minutes) * 600.0;
+        p.rate_ = arrivalsPerHour / 36000.0;
+        p.inWeights_ = inWeights.empty() ? std::vector<double>(floors_, 1.0) : std::move(inWeights);
+        p.outWeights_ = outWeights.empty() ? std::vector<double>(floors_, 1.0) : std::move(outWeights);
+        if (int(p.inWeights_.size()) == floors_ && int(p.outWeights_.size()) == floors_) {
+            p.origins_.build(p.inWeights_);
+            p.destinations_.resize(floors_);
+            for (int in = 0; in < floors_; ++in) {
+                // The destination weights, leaving out the origin; if every
+                // other floor has zero weight, then all of them alike.
+                std::vector<double> w(p.outWeights_);
+                w[in] = 0;
+                if (!p.destinations_[in].build(w)) {
+                    std::fill(w.begin(), w.end(), 1.0);
+                    w[in] = 0;
+                    p.destinations_[in].build(w);
+                }
+            }
+        }
+        periods_.push_back(std::move(p));
+    }
+
+    // Add a period whose users travel from floor i to floor j with relative
+    // weight od[i * floors + j]. The diagonal is ignored.
+    void addPeriodWithMatrix(int hours, int minutes, double arrivalsPerHour, std::vector<double> od) {
+        this->addPeriod(hours, minutes, arrivalsPerHour);
+        Period& p = periods_.back();
+        p.od_ = std::move(od);
+        if (int(p.od_.size()) == floors_ * floors_) {
+            for (int f = 0; f < floors_; ++f) {
+                p.od_[f * floors_ + f] = 0;
+            }
+            p.pairs_.build(p.od_);
+        }
+    }
+
+    // Returns an empty string if the profile is usable, or else what's wrong with it.
+    std::string validate() const {
+        if (periods_.empty() || periods_[0].start_ != 0) {
+            return "the first period must start at 00:00";
+        }
+        bool anyArrivals = false;
+        for (size_t i = 0; i < periods_.size(); ++i) {
+            const Period& p = periods_[i];
+            if (i != 0 && !(periods_[i - 1].start_ < p.start_)) {
+                return "periods must be in increasing order of start time";
+            }
+            if (p.start_ >= ticksPerDay) {
+                return "periods must start before 24:00";
+            }
+            if (!(p.rate_ >= 0)) {
+                return "arrival rates must not be negative";
+            }
+            if (int(p.inWeights_.size()) != floors_ || int(p.outWeights_.size()) != floors_) {
+                return "each period needs one origin and one destination weight per floor";
+            }
+            if (!p.od_.empty()) {
+                if (int(p.od_.size()) != floors_ * floors_) {
+                    return "an origin-destination matrix needs one row of weights per floor, with one weight per floor";
+                }
+                double total = 0;
+                for (double w : p.od_) {
+                    if (w < 0) {
+                        return "origin-destination weights must not be negative";
+                    }
+                    total += w;
+                }
+                if (p.rate_ > 0 && total <= 0) {
+                    return "some trip between different floors must have positive weight";
+                }
+            }
+            double in = 0;
+            for (int f = 0; f < floors_; ++f) {
+                if (p.inWeights_[f] < 0 || p.outWeights_[f] < 0) {
+                    return "floor weights must not be negative";
+                }
+                in += p.inWeights_[f];
+            }
+            if (p.rate_ > 0 && in <= 0) {
+                return "some origin floor must have positive weight";
+            }
+            anyArrivals = anyArrivals || (p.rate_ > 0);
+        }
+        if (!anyArrivals) {
+            return "some period must have a positive arrival rate";
+        }
+        return "";
+    }
+
+    // Move st forward to the next arrival, given e drawn from Exp(1).
+    void advance(TrafficState& st, double e) const {
+        while (true) {
+            double end = std::floor(st.clock_ / ticksPerDay) * ticksPerDay + this->periodEnd(st.period_);
+            double rate = periods_[st.period_].rate_;
+            if (rate > 0 && rate * (end - st.clock_) >= e) {
+                st.clock_ += e / rate;
+                return;
+            }
+            e -= rate * (end - st.clock_);
+            st.clock_ = end;
+            st.period_ = (st.period_ + 1) % int(periods_.size());
+        }
+    }
+
+    // Pick the origin and destination floors of an arrival in the given
+    // period, given two uniforms in [0, 1). With a matrix, only u1 is used.
+    void pickFloors(int period, double u1, double u2, int& in, int& out) const {
+        const Period& p = periods_[period];
+        if (!p.od_.empty()) {
+            int pair = p.pairs_.sample(u1);
+            in = pair / floors_;
+            out = pair % floors_;
+        } else {
+            in = p.origins_.sample(u1);
+            out = p.destinations_[in].sample(u2);
+        }
+    }
+
+    // A weekday in an office building whose lobby is floor 0: quiet nights,
+    // an up-peak from the lobby in the morning, two-way lunch traffic, and
+    // a down-peak to the lobby in the evening.
+    static TrafficProfile office(int floors) {
+        TrafficProfile t(floors);
+        std::vector<double> lobby(floors, 0.0);
+        lobby[0] = 1;
+        std::vector<double> upstairs(floors, 1.0);
+        upstairs[0] = 0;
+        std::vector<double> lunch(floors, 1.0);
+        lunch[0] = floors - 1;
+        t.addPeriod(0, 0, 4);
+        t.addPeriod(7, 0, 40, lobby, upstairs);
+        t.addPeriod(8, 0, 180, lobby, upstairs);
+        t.addPeriod(9, 30, 50);
+        t.addPeriod(12, 0, 150, lunch, lunch);
+        t.addPeriod(13, 30, 50);
+        t.addPeriod(17, 0, 180, upstairs, lobby);
+        t.addPeriod(18, 30, 30, upstairs, lobby);
+        t.addPeriod(20, 0, 4);
+        return t;
+    }
+
+    // Read a profile from a file of lines like
+    //     08:00  180   1 0 0 0 0 : 0 1 1 1 1
+    // giving the start time, the arrival rate per hour, and optionally the
+    // origin weights, a colon, and the destination weights, one per floor.
+    // Instead of weights, "od" means that the next lines (one per origin
+    // floor) give the weights of the trips to each destination floor.
+    // Blank lines and lines starting with '#' are ignored. Returns false,
+    // having printed why, if the file can't be read or the profile is bad.
+    bool load(const char *path) {
+        FILE *fp = fopen(path, "r");
+        if (fp == nullptr) {
+            perror(path);
+            return false;
+        }
+        char line[1 << 16];
+        int lineNumber = 0;
+        bool ok = true;
+        while (ok && fgets(line, sizeof line, fp) != nullptr) {
+            lineNumber += 1;
+            char *p = line;
+            while (*p == ' ' || *p == '\t') {
+                ++p;
+            }
+            if (*p == '#' || *p == '\n' || *p == '\0') {
+                continue;
+            }
+            int hours, minutes, n;
+            double rate;
+            if (sscanf(p, "%d:%d %lf%n", &hours, &minutes, &rate, &n) != 3) {
+                fprintf(stderr, "%s:%d: expected hh:mm and arrivals per hour\n", path, lineNumber);
+                ok = false;
+                break;
+            }
+            p += n;
+            while (*p == ' ' || *p == '\t') {
+                ++p;
+            }
+            if (strncmp(p, "od", 2) == 0) {
+                std::vector<double> od;
+                int rows = 0;
+                while (rows < floors_ && fgets(line, sizeof line, fp) != nullptr) {
+                    lineNumber += 1;
+                    char *q = line;
+                    while (*q == ' ' || *q == '\t') {
+                        ++q;
+                    }
+                    if (*q == '#' || *q == '\n' || *q == '\0') {
+                        continue;
+                    }
+                    int count = 0;
+                    while (true) {
+                        char *end;
+                        double w = strtod(q, &end);
+                        if (end == q) {
+                            break;
+                        }
+                        od.push_back(w);
+                        count += 1;
+                        q = end;
+                    }
+                    if (count != floors_) {
+                        fprintf(stderr, "%s:%d: expected %d weights, one per destination floor\n", path, lineNumber, floors_);
+                        ok = false;
+                        break;
+                    }
+                    rows += 1;
+                }
+                this->addPeriodWithMatrix(hours, minutes, rate, std::move(od));
+                continue;
+            }
+            std::vector<double> weights[2];
+            for (int side = 0; side < 2; ++side) {
+                while (true) {
+                    char *end;
+                    double w = strtod(p, &end);
+                    if (end == p) {
+                        break;
+                    }
+                    weights[side].push_back(w);
+                    p = end;
+                }
+                while (*p == ' ' || *p == '\t') {
+                    ++p;
+                }
+                if (side == 0 && *p == ':') {
+                    ++p;
+                } else {
+                    break;
+                }
+            }
+            if (*p != '\n' && *p != '\0' && *p != '#') {
+                fprintf(stderr, "%s:%d: unexpected '%c'\n", path, lineNumber, *p);
+                ok = false;
+            }
+            this->addPeriod(hours, minutes, rate, weights[0], weights[1]);
+        }
+        fclose(fp);
+        if (ok) {
+            std::string problem = this->validate();
+            if (!problem.empty()) {
+                fprintf(stderr, "%s: %s\n", path, problem.c_str());
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+private:
+    double periodEnd(int period) const {
+        return (period + 1 < int(periods_.size())) ? periods_[period + 1].start_ : ticksPerDay;
+    }
+
+    int floors_;
+    std::vector<Period> periods_;
+};
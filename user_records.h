@@ -0,0 +1,159 @@
+#pragma once
+
+// Per-user results, one record per user who arrived at their destination
+// or walked away, written to a file for analysis outside the simulator.
+// Records are formatted into a large buffer and written out a megabyte at
+// a time, so even a run of 10^8 users is limited by the disk, not by
+// printf or by the number of system calls.
+//
+// A file whose name ends in ".csv" gets one comma-separated line per user,
+// after a header line; "-" writes CSV to standard output. Any other file
+// gets the binary format: a 16-byte header ("KEUSERS2" and a little-endian
+// 64-bit record count) followed by 32-byte UserRecords, which numpy (for
+// one) reads directly as
+//     dtype=[('user','<i8'),('queue_time','<i8'),('ride_time','<i8'),
+//            ('in','<i2'),('out','<i2'),('max_occupancy','<i2'),('walked','<i2')]
+// The times are 64-bit, like the simulation's Durations, so that no wait
+// is too long to record.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+struct UserRecord {
+    int64_t user_;          // the user's number, counting from 1
+    int64_t queueTime_;     // ticks spent in the queue (before boarding or walking away)
+    int64_t rideTime_;      // ticks spent in the elevator; 0 if the user walked
+    int16_t in_;            // floor on which the user arrived
+    int16_t out_;           // floor the user wanted to go to
+    int16_t maxOccupancy_;  // most users in the elevator during the ride; 0 if the user walked
+    int16_t walked_;        // 1 if the user walked away, else 0
+};
+static_assert(sizeof(UserRecord) == 32, "UserRecord is a file format");
+
+static const char userRecordFileMagic[8] = { 'K', 'E', 'U', 'S', 'E', 'R', 'S', '2' };
+
+class UserRecordSink {
+public:
+    static constexpr size_t bufferSize = 1 << 20;
+
+    UserRecordSink() = default;
+    UserRecordSink(const UserRecordSink&) = delete;
+    UserRecordSink& operator=(const UserRecordSink&) = delete;
+
+    ~UserRecordSink() { this->close(); }
+
+    // Returns false, having printed why, if the file can't be created.
+    bool open(const char *path) {
+        path_ = path;
+        size_t n = strlen(path);
+        csv_ = (strcmp(path, "-") == 0) || (n >= 4 && strcmp(path + n - 4, ".csv") == 0);
+        fp_ = (strcmp(path, "-") == 0) ? stdout : fopen(path, "wb");
+        if (fp_ == nullptr) {
+            perror(path);
+            return false;
+        }
+        buffer_ = new char[bufferSize];
+        if (csv_) {
+            this->append("user,in,out,queue_time,ride_time,max_occupancy,walked\n");
+        } else {
+            uint64_t count = 0;
+            this->append(userRecordFileMagic, 8);
+            this->append(&count, sizeof count);
+        }
+        return true;
+    }
+
+    void add(const UserRecord& r) {
+        if (used_ + maxLineLength > bufferSize) {
+            this->flush();
+        }
+        if (csv_) {
+            char *p = buffer_ + used_;
+            p = appendNumber(p, r.user_);
+            *p++ = ',';
+            p = appendNumber(p, r.in_);
+            *p++ = ',';
+            p = appendNumber(p, r.out_);
+            *p++ = ',';
+            p = appendNumber(p, r.queueTime_);
+            *p++ = ',';
+            p = appendNumber(p, r.rideTime_);
+            *p++ = ',';
+            p = appendNumber(p, r.maxOccupancy_);
+            *p++ = ',';
+            *p++ = char('0' + r.walked_);
+            *p++ = '\n';
+            used_ = p - buffer_;
+        } else {
+            memcpy(buffer_ + used_, &r, sizeof r);
+            used_ += sizeof r;
+        }
+        count_ += 1;
+    }
+
+    long long count() const { return count_; }
+
+    // Write out what's buffered and, for a binary file, the record count.
+    // Returns false, having printed why, if anything couldn't be written.
+    bool close() {
+        if (fp_ == nullptr) {
+            return ok_;
+        }
+        this->flush();
+        if (!csv_ && fseek(fp_, 8, SEEK_SET) == 0) {
+            uint64_t count = count_;
+            fwrite(&count, sizeof count, 1, fp_);
+        }
+        ok_ = !ferror(fp_) && ok_;
+        ok_ = ((fp_ == stdout) ? fflush(fp_) : fclose(fp_)) == 0 && ok_;
+        if (!ok_) {
+            perror(path_);
+        }
+        fp_ = nullptr;
+        delete[] buffer_;
+        buffer_ = nullptr;
+        return ok_;
+    }
+
+private:
+    static constexpr size_t maxLineLength = 128;
+
+    void flush() {
+        if (used_ != 0 && fwrite(buffer_, 1, used_, fp_) != used_) {
+            ok_ = false;
+        }
+        used_ = 0;
+    }
+
+    void append(const void *p, size_t n) {
+        memcpy(buffer_ + used_, p, n);
+        used_ += n;
+    }
+    void append(const char *s) { this->append(s, strlen(s)); }
+
+    static char *appendNumber(char *p, long long x) {
+        if (x < 0) {
+            *p++ = '-';
+            x = -x;
+        }
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = char('0' + x % 10);
+            x /= 10;
+        } while (x != 0);
+        while (n != 0) {
+            *p++ = digits[--n];
+        }
+        return p;
+    }
+
+    const char *path_ = nullptr;
+    FILE *fp_ = nullptr;
+    bool csv_ = false;
+    bool ok_ = true;
+    char *buffer_ = nullptr;
+    size_t used_ = 0;
+    long long count_ = 0;
+};
@@ -5,6 +5,13 @@
 // Based on the C version by David Blackman and Sebastiano Vigna (2018),
 // https://prng.di.unimi.it/xoshiro256starstar.c
 
+#include <cassert>
+#include <cstddef>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 static_assert(sizeof(long long) == 8, "64-bit machines only");
 
 struct xoshiro256ss {
@@ -46,4 +53,202 @@ struct xoshiro256ss {
         s[3] = rotl(s[3], 45);
         return result;
     }
+
+    // Advance the generator by 2^128 steps, as if it had been called that
+    // many times. Calling jump() k times from one seed gives streams that
+    // won't overlap for 2^128 outputs each.
+    constexpr void jump() {
+        const u64 polynomial[4] = { 0x180ec6d33cfd0abauLL, 0xd5a61266f0c9392cuLL, 0xa9582618e03fc9aauLL, 0x39abdc4529b1661cuLL };
+        u64 t[4] = {};
+        for (u64 word : polynomial) {
+            for (int b = 0; b < 64; ++b) {
+                if (word & (1uLL << b)) {
+                    t[0] ^= s[0];
+                    t[1] ^= s[1];
+                    t[2] ^= s[2];
+                    t[3] ^= s[3];
+                }
+                (*this)();
+            }
+        }
+        s[0] = t[0];
+        s[1] = t[1];
+        s[2] = t[2];
+        s[3] = t[3];
+    }
+
+    // The high and low halves of the 128-bit product a * b.
+    static constexpr u64 mul128(u64 a, u64 b, u64& low) {
+#ifdef __SIZEOF_INT128__
+        __extension__ using u128 = unsigned __int128;
+        u128 m = u128(a) * b;
+        low = u64(m);
+        return u64(m >> 64);
+#else
+        u64 a0 = a & 0xffffffffu, a1 = a >> 32;
+        u64 b0 = b & 0xffffffffu, b1 = b >> 32;
+        u64 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+        u64 mid = (p00 >> 32) + (p01 & 0xffffffffu) + (p10 & 0xffffffffu);
+        low = (mid << 32) | (p00 & 0xffffffffu);
+        return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+    }
+
+    // A uniformly distributed integer in [0, range), for range > 0, by
+    // Lemire's multiply-shift with rejection ("Fast Random Integer
+    // Generation in an Interval", 2019). Unlike (*this)() % range, this is
+    // unbiased, and it divides only when it might have to reject a draw,
+    // which for small ranges is almost never.
+    constexpr u64 bounded(u64 range) {
+        return boundedFrom(range, *this);
+    }
+
+    // The same, but drawing from next(), which might hand out outputs of
+    // this generator that were computed ahead of time.
+    template<class Next>
+    static constexpr u64 boundedFrom(u64 range, Next& next) {
+        u64 low = 0;
+        u64 high = mul128(next(), range, low);
+        if (low < range) {
+            u64 threshold = (0 - range) % range;
+            while (low < threshold) {
+                high = mul128(next(), range, low);
+            }
+        }
+        return high;
+    }
+};
+
+// Lanes copies of xoshiro256**, stepped together, for bulk generation.
+// Lane k starts where a scalar generator from the same seed would be after
+// k calls to jump(), so the lanes are separate, non-overlapping streams.
+// fill() interleaves the lanes' outputs: out[i * Lanes + k] is the i'th
+// output of lane k. It uses AVX-512 or AVX2 when compiled for them (with
+// -mavx512f or -mavx2), and otherwise plain loops over the lanes.
+template<int Lanes>
+struct xoshiro256ss_lanes {
+    using u64 = xoshiro256ss::u64;
+    static_assert(Lanes > 0, "need at least one lane");
+
+    alignas(64) u64 s[4][Lanes];  // s[j][k] is word j of lane k's state
+
+    explicit xoshiro256ss_lanes(xoshiro256ss g) {
+        for (int k = 0; k < Lanes; ++k) {
+            for (int j = 0; j < 4; ++j) {
+                s[j][k] = g.s[j];
+            }
+            g.jump();
+        }
+    }
+
+    // A scalar generator in the current state of lane k.
+    xoshiro256ss lane(int k) const {
+        xoshiro256ss g;
+        for (int j = 0; j < 4; ++j) {
+            g.s[j] = s[j][k];
+        }
+        return g;
+    }
+
+    // Write n outputs to out. Every lane advances by n / Lanes steps,
+    // rounded up; the outputs past n of the last step are discarded.
+    void fill(u64 *out, size_t n) {
+        size_t steps = n / Lanes;
+        this->generate(out, steps);
+        if (size_t rest = n % Lanes) {
+            u64 last[Lanes];
+            this->generate(last, 1);
+            for (size_t k = 0; k < rest; ++k) {
+                out[steps * Lanes + k] = last[k];
+            }
+        }
+    }
+
+private:
+    // The lanes [0, vectorLanes) are generated with SIMD instructions, and
+    // the rest, if any, one at a time.
+#if defined(__AVX2__)
+    static constexpr int vectorLanes = (Lanes / 4) * 4;  // by eights with AVX-512, then by fours
+#elif defined(__AVX512F__)
+    static constexpr int vectorLanes = (Lanes / 8) * 8;
+#else
+    static constexpr int vectorLanes = 0;
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"  // false positives in GCC's avx512fintrin.h
+#endif
+    void generate(u64 *out, size_t steps) {
+        int k = 0;
+#if defined(__AVX512F__)
+        for (; k + 8 <= Lanes; k += 8) {
+            __m512i s0 = _mm512_loadu_si512(&s[0][k]);
+            __m512i s1 = _mm512_loadu_si512(&s[1][k]);
+            __m512i s2 = _mm512_loadu_si512(&s[2][k]);
+            __m512i s3 = _mm512_loadu_si512(&s[3][k]);
+            for (size_t i = 0; i < steps; ++i) {
+                __m512i x = _mm512_add_epi64(_mm512_slli_epi64(s1, 2), s1);  // s1 * 5
+                x = _mm512_rol_epi64(x, 7);
+                x = _mm512_add_epi64(_mm512_slli_epi64(x, 3), x);  // * 9
+                _mm512_storeu_si512(&out[i * Lanes + k], x);
+                __m512i t = _mm512_slli_epi64(s1, 17);
+                s2 = _mm512_xor_si512(s2, s0);
+                s3 = _mm512_xor_si512(s3, s1);
+                s1 = _mm512_xor_si512(s1, s2);
+                s0 = _mm512_xor_si512(s0, s3);
+                s2 = _mm512_xor_si512(s2, t);
+                s3 = _mm512_rol_epi64(s3, 45);
+            }
+            _mm512_storeu_si512(&s[0][k], s0);
+            _mm512_storeu_si512(&s[1][k], s1);
+            _mm512_storeu_si512(&s[2][k], s2);
+            _mm512_storeu_si512(&s[3][k], s3);
+        }
+#endif
+#if defined(__AVX2__)
+        auto rotl = [](__m256i x, int r) {
+            return _mm256_or_si256(_mm256_slli_epi64(x, r), _mm256_srli_epi64(x, 64 - r));
+        };
+        for (; k + 4 <= Lanes; k += 4) {
+            __m256i s0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[0][k]));
+            __m256i s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[1][k]));
+            __m256i s2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[2][k]));
+            __m256i s3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&s[3][k]));
+            for (size_t i = 0; i < steps; ++i) {
+                __m256i x = _mm256_add_epi64(_mm256_slli_epi64(s1, 2), s1);  // s1 * 5
+                x = rotl(x, 7);
+                x = _mm256_add_epi64(_mm256_slli_epi64(x, 3), x);  // * 9
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[i * Lanes + k]), x);
+                __m256i t = _mm256_slli_epi64(s1, 17);
+                s2 = _mm256_xor_si256(s2, s0);
+                s3 = _mm256_xor_si256(s3, s1);
+                s1 = _mm256_xor_si256(s1, s2);
+                s0 = _mm256_xor_si256(s0, s3);
+                s2 = _mm256_xor_si256(s2, t);
+                s3 = rotl(s3, 45);
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(&s[0][k]), s0);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(&s[1][k]), s1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(&s[2][k]), s2);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(&s[3][k]), s3);
+        }
+#endif
+        assert(k == vectorLanes);
+        for (size_t i = 0; i < steps; ++i) {
+            for (k = vectorLanes; k < Lanes; ++k) {
+                out[i * Lanes + k] = xoshiro256ss::rotl(s[1][k] * 5, 7) * 9;
+                u64 t = s[1][k] << 17;
+                s[2][k] ^= s[0][k];
+                s[3][k] ^= s[1][k];
+                s[1][k] ^= s[2][k];
+                s[0][k] ^= s[3][k];
+                s[2][k] ^= t;
+                s[3][k] = xoshiro256ss::rotl(s[3][k], 45);
+            }
+        }
+    }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
 };
@@ -0,0 +1,143 @@
+#pragma once
+
+// Exponential and normal variates by Marsaglia and Tsang's ziggurat method
+// ("The Ziggurat Method for Generating Random Variables", 2000), drawing
+// from xoshiro256ss. The density is covered by 256 layers of equal area;
+// about 99% of draws land inside a layer's rectangle and cost one 64-bit
+// output, a table lookup, a multiply and a compare, with no log() or exp().
+// Each 64-bit output supplies the layer (low 8 bits), the sign of a normal
+// variate (bit 8), and a 53-bit uniform (the top bits).
+//
+// The helpers at the end round variates to whole ticks for Durations.
+
+#include <cmath>
+
+#include "xoshiro256ss.h"
+
+namespace ziggurat {
+
+// x_[0] is the width of the bottom layer (base rectangle plus tail, as a
+// rectangle of the same area), x_[1] = r where the tail starts, and x_[i]
+// decreases to x_[256] = 0 at the peak; f_[i] is the density at x_[i].
+struct Tables {
+    double x_[257];
+    double f_[257];
+
+    template<class Density, class Inverse>
+    Tables(double r, double area, Density f, Inverse finv) {
+        x_[0] = area / f(r);
+        x_[1] = r;
+        for (int i = 1; i < 256; ++i) {
+            x_[i + 1] = finv(f(x_[i]) + area / x_[i]);
+        }
+        x_[256] = 0;
+        for (int i = 0; i <= 256; ++i) {
+            f_[i] = f(x_[i]);
+        }
+        f_[0] = 0;  // never used as a wedge bound
+        f_[256] = 1;
+    }
+};
+
+inline const Tables& exponentialTables() {
+    static const Tables t(
+        7.69711747013104972,
+        (7.69711747013104972 + 1) * std::exp(-7.69711747013104972),  // r f(r) plus the tail's area
+        [](double x) { return std::exp(-x); },
+        [](double y) { return (y >= 1) ? 0.0 : -std::log(y); });
+    return t;
+}
+
+inline const Tables& normalTables() {
+    const double r = 3.6541528853610088;
+    static const Tables t(
+        r,
+        r * std::exp(-r * r / 2) + std::sqrt(std::acos(-1.0) / 2) * std::erfc(r / std::sqrt(2.0)),
+        [](double x) { return std::exp(-x * x / 2); },
+        [](double y) { return (y >= 1) ? 0.0 : std::sqrt(-2 * std::log(y)); });
+    return t;
+}
+
+inline double uniformFrom(xoshiro256ss::u64 bits) {
+    return double(bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+} // namespace ziggurat
+
+// An exponential variate with mean 1.
+inline double exponentialVariate(xoshiro256ss& g)
+{
+    const ziggurat::Tables& t = ziggurat::exponentialTables();
+    double offset = 0;  // the tail is r plus another exponential
+    while (true) {
+        xoshiro256ss::u64 bits = g();
+        int i = int(bits & 0xff);
+        double x = ziggurat::uniformFrom(bits) * t.x_[i];
+        if (x < t.x_[i + 1]) {
+            return offset + x;
+        }
+        if (i == 0) {
+            offset += t.x_[1];
+            continue;
+        }
+        double y = t.f_[i + 1] + ziggurat::uniformFrom(g()) * (t.f_[i] - t.f_[i + 1]);
+        if (y < std::exp(-x)) {
+            return offset + x;
+        }
+    }
+}
+
+// A normal variate with mean 0 and standard deviation 1.
+inline double normalVariate(xoshiro256ss& g)
+{
+    const ziggurat::Tables& t = ziggurat::normalTables();
+    while (true) {
+        xoshiro256ss::u64 bits = g();
+        int i = int(bits & 0xff);
+        double sign = (bits & 0x100) ? -1.0 : 1.0;
+        double x = ziggurat::uniformFrom(bits) * t.x_[i];
+        if (x < t.x_[i + 1]) {
+            return sign * x;
+        }
+        if (i == 0) {
+            // Marsaglia's method for the tail beyond r.
+            double r = t.x_[1];
+            double a, b;
+            do {
+                a = -std::log1p(-ziggurat::uniformFrom(g())) / r;
+                b = -std::log1p(-ziggurat::uniformFrom(g()));
+            } while (b + b < a * a);
+            return sign * (r + a);
+        }
+        double y = t.f_[i + 1] + ziggurat::uniformFrom(g()) * (t.f_[i] - t.f_[i + 1]);
+        if (y < std::exp(-x * x / 2)) {
+            return sign * x;
+        }
+    }
+}
+
+// A nonnegative number of ticks: x rounded to the nearest tick, or zero if
+// x is negative.
+inline long long roundToTicks(double x)
+{
+    return (x > 0) ? std::llround(x) : 0;
+}
+
+// An exponentially distributed duration with the given mean, in ticks.
+inline long long exponentialTicks(xoshiro256ss& g, double mean)
+{
+    return roundToTicks(mean * exponentialVariate(g));
+}
+
+// A normally distributed duration, cut off at zero, in ticks.
+inline long long normalTicks(xoshiro256ss& g, double mean, double stddev)
+{
+    return roundToTicks(mean + stddev * normalVariate(g));
+}
+
+// A log-normally distributed duration in ticks, where mu and sigma are the
+// mean and standard deviation of its logarithm. (This one needs an exp().)
+inline long long lognormalTicks(xoshiro256ss& g, double mu, double sigma)
+{
+    return roundToTicks(std::exp(mu + sigma * normalVariate(g)));
+}